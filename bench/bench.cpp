@@ -19,6 +19,7 @@
 #include "bench_utils.h"
 #include <random>
 #include <iostream>
+#include <thread>
 
 using namespace std;
 using namespace osiris;
@@ -62,6 +63,18 @@ void benchFixedCorrect(const string& name) {
         testDataRange test = prepareRangeTest(x, 8, 8, 0, 2);
         results.emplace_back(evaluateRange(&test, 1, "5", name, false));
     }
+    std::cout << "Testing batched random point queries" << std::endl;
+    for (auto x : sizes)
+    {
+        testDataPoint test = preparePointTest(x, 8, 8, 0, 2);
+        results.emplace_back(evaluatePointBatch(&test, 1024, "6", name));
+    }
+    std::cout << "Testing concurrent random point queries" << std::endl;
+    for (auto x : sizes)
+    {
+        testDataPoint test = preparePointTest(x, 8, 8, 0, 2);
+        results.emplace_back(evaluatePointConcurrent(&test, std::max(1u, std::thread::hardware_concurrency()), "7", name));
+    }
     saveQueryReport(results, "fixed");
     saveBuildReport(results, "fixed");
     saveSerialReport(results, "fixed");
@@ -105,6 +118,18 @@ void benchNoPrefixCorrect(const string& name) {
         testDataRange test = prepareRangeTest(x, 32, 64, 0, 2);
         results.emplace_back(evaluateRange(&test, 1, "5", name, false));
     }
+    std::cout << "Testing batched random point queries" << std::endl;
+    for (auto x : sizes)
+    {
+        testDataPoint test = preparePointTest(x, 32, 64, 1, 2);
+        results.emplace_back(evaluatePointBatch(&test, 1024, "6", name));
+    }
+    std::cout << "Testing concurrent random point queries" << std::endl;
+    for (auto x : sizes)
+    {
+        testDataPoint test = preparePointTest(x, 32, 64, 1, 2);
+        results.emplace_back(evaluatePointConcurrent(&test, std::max(1u, std::thread::hardware_concurrency()), "7", name));
+    }
     saveQueryReport(results, "no_prefix");
     saveBuildReport(results, "no_prefix");
     saveSerialReport(results, "no_prefix");
@@ -149,15 +174,100 @@ void benchCommonCorrect(const string& name) {
         testDataRange test = prepareRangeTest(x, 32, 64, 2, 2);
         results.emplace_back(evaluateRange(&test, 1, "5", name, false));
     }
+    std::cout << "Testing batched random point queries" << std::endl;
+    for (auto x : sizes)
+    {
+        testDataPoint test = preparePointTest(x, 32, 64, 2, 2);
+        results.emplace_back(evaluatePointBatch(&test, 1024, "6", name));
+    }
+    std::cout << "Testing concurrent random point queries" << std::endl;
+    for (auto x : sizes)
+    {
+        testDataPoint test = preparePointTest(x, 32, 64, 2, 2);
+        results.emplace_back(evaluatePointConcurrent(&test, std::max(1u, std::thread::hardware_concurrency()), "7", name));
+    }
     saveQueryReport(results, "common");
     saveBuildReport(results, "common");
     saveSerialReport(results, "common");
 }
 
+void benchRetries(const string& name) {
+    vector<size_t> sizes = { 100000, 1000000 };
+
+    vector<testResult> results;
+    std::cout << "Testing builds on sequential ids" << std::endl;
+    for (auto x : sizes)
+    {
+        auto set = generateStructuredData(x, 0);
+        vector<string> data(set.begin(), set.end());
+        results.emplace_back(evaluateBuild(&data, 10, "0", name));
+    }
+    std::cout << "Testing builds on decimal ids" << std::endl;
+    for (auto x : sizes)
+    {
+        auto set = generateStructuredData(x, 1);
+        vector<string> data(set.begin(), set.end());
+        results.emplace_back(evaluateBuild(&data, 10, "1", name));
+    }
+    std::cout << "Testing builds on spread ids" << std::endl;
+    for (auto x : sizes)
+    {
+        auto set = generateStructuredData(x, 2);
+        vector<string> data(set.begin(), set.end());
+        results.emplace_back(evaluateBuild(&data, 10, "2", name));
+    }
+    saveRetryReport(results, name);
+}
+
+void benchLoad(const string& name) {
+    vector<size_t> sizes = { 100000, 1000000, 10000000 };
+
+    vector<testResult> results;
+    std::cout << "Testing loads of fixed length filters" << std::endl;
+    for (auto x : sizes)
+    {
+        auto set = generateData(x, 8, 8, 0);
+        vector<string> data(set.begin(), set.end());
+        results.emplace_back(evaluateLoad(&data, 5, "0", name));
+    }
+    std::cout << "Testing loads of common filters" << std::endl;
+    for (auto x : sizes)
+    {
+        auto set = generateData(x, 32, 64, 2);
+        vector<string> data(set.begin(), set.end());
+        results.emplace_back(evaluateLoad(&data, 5, "1", name));
+    }
+    saveLoadReport(results, name);
+}
+
+void benchReplicas(const string& name) {
+    // large enough for the probes to miss the caches, so they go to the memory of some node
+    vector<size_t> sizes = { 10000000 };
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+
+    vector<testResult> results;
+    std::cout << "Testing point queries on all cores, one shared filter" << std::endl;
+    for (auto x : sizes)
+    {
+        testDataPoint test = preparePointTest(x, 8, 8, 0, 2);
+        results.emplace_back(evaluatePointConcurrent(&test, threads, "0", name, false));
+    }
+    std::cout << "Testing point queries on all cores, a copy on every NUMA node" << std::endl;
+    for (auto x : sizes)
+    {
+        testDataPoint test = preparePointTest(x, 8, 8, 0, 2);
+        results.emplace_back(evaluatePointConcurrent(&test, threads, "1", name, false, true));
+    }
+    saveQueryReport(results, name);
+}
+
 int main() {
 
     benchFixedCorrect("fixed");
     benchNoPrefixCorrect("no_prefix");
     benchCommonCorrect("common");
+    benchRetries("retries");
+    benchLoad("load");
+    benchReplicas("replicas");
     return 0;
 }
\ No newline at end of file
@@ -21,6 +21,12 @@
 #include <fstream>
 #include <utility>
 #include <iostream>
+#include <thread>
+
+#if defined(__unix__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 std::string generate(size_t minLen, size_t maxLen)
 {
@@ -238,6 +244,37 @@ std::set<std::string, cmp> generateData(size_t size, size_t minLen, size_t maxLe
     return res;
 }
 
+std::set<std::string, cmp> generateStructuredData(size_t size, int setType)
+{
+    std::set<std::string, cmp> res;
+    for (size_t i = 0; i < size; i++)
+    {
+        std::string key;
+        if (setType == 0)
+        {
+            key = std::string(8, '0');
+            for (size_t j = 0; j < 8; j++)
+            {
+                key[7 - j] = (char) ((i >> (j * 8)) & 255);
+            }
+        }
+        else if (setType == 1)
+        {
+            key = "id" + std::to_string(i);
+        }
+        else
+        {
+            key = std::string(16, '0');
+            for (size_t j = 0; j < 16; j++)
+            {
+                key[15 - j] = (char) (((i >> j) & 1) << 4);
+            }
+        }
+        res.insert(key);
+    }
+    return res;
+}
+
 testResult evaluatePoint(testDataPoint* testData, size_t repeat, std::string id, std::string name, bool verify) {
     testResult result;
     result.id = std::move(id);
@@ -298,6 +335,186 @@ testResult evaluateRange(testDataRange* testData, size_t repeat, std::string id,
 }
 
 
+testResult evaluatePointBatch(testDataPoint* testData, size_t batchSize, std::string id, std::string name, bool verify) {
+    testResult result;
+    result.id = std::move(id);
+    result.name = std::move(name);
+    result.keysNum = testData->data.size();
+
+    osiris::OsirisFilter* filter = buildAndSerial(&testData->data, 1, &result);
+
+    std::vector<uint8_t> answers((batchSize + 7) >> 3);
+    std::span<const std::string> queries(testData->pointQueries);
+
+    for (size_t start = 0; start < queries.size(); start += batchSize)
+    {
+        auto batch = queries.subspan(start, std::min(batchSize, queries.size() - start));
+
+        auto queryStart = std::chrono::high_resolution_clock::now();
+        filter->pointQueryBatch(batch, answers.data());
+        auto queryEnd = std::chrono::high_resolution_clock::now();
+
+        // time is reported per query to be comparable with single queries
+        for (size_t i = 0; i < batch.size(); i++)
+        {
+            result.queryTime.push_back((queryEnd - queryStart).count() / (long long)batch.size());
+        }
+        if (verify)
+        {
+            for (size_t i = 0; i < batch.size(); i++)
+            {
+                bool kek = (answers[i >> 3] >> (i & 7)) & 1;
+                result.success += kek == testData->pointResult[start + i];
+            }
+        }
+    }
+
+    delete filter;
+
+    return result;
+}
+
+testResult evaluateBuild(std::vector<std::string>* data, size_t repeat, std::string id, std::string name) {
+    testResult result;
+    result.id = std::move(id);
+    result.name = std::move(name);
+    result.keysNum = data->size();
+
+    for (size_t i = 0; i < repeat; i++)
+    {
+        auto buildStart = std::chrono::high_resolution_clock::now();
+        osiris::OsirisFilter* filter = osiris::build(*data);
+        auto buildEnd = std::chrono::high_resolution_clock::now();
+
+        result.buildTime.push_back((buildEnd - buildStart).count());
+        result.buildRetries.push_back(filter->getBuildRetries());
+        delete filter;
+    }
+
+    return result;
+}
+
+testResult evaluatePointConcurrent(testDataPoint* testData, size_t threads, std::string id, std::string name, bool verify,
+                                   bool replicate) {
+    testResult result;
+    result.id = std::move(id);
+    result.name = std::move(name);
+    result.keysNum = testData->data.size();
+
+    osiris::OsirisFilter* filter = buildAndSerial(&testData->data, 1, &result);
+    std::unique_ptr<osiris::ReplicatedOsirisFilter> replicas;
+    if (replicate)
+    {
+        replicas.reset(new osiris::ReplicatedOsirisFilter(*filter));
+    }
+
+    // every thread answers all queries of the test on the same filter, starting from its own offset
+    // so that different threads touch different parts of the filter at the same time
+    size_t queries = testData->pointQueries.size();
+    std::vector<std::vector<long long>> times(threads);
+    std::vector<size_t> success(threads, 0);
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&, t]()
+        {
+            times[t].reserve(queries);
+            for (size_t k = 0; k < queries; k++)
+            {
+                size_t i = (k + t * queries / threads) % queries;
+                auto queryStart = std::chrono::high_resolution_clock::now();
+                auto kek = replicas ? replicas->pointQuery(testData->pointQueries[i])
+                                    : filter->pointQuery(testData->pointQueries[i]);
+                auto queryEnd = std::chrono::high_resolution_clock::now();
+
+                times[t].push_back((queryEnd - queryStart).count());
+                if (verify)
+                {
+                    success[t] += kek == testData->pointResult[i];
+                }
+            }
+        });
+    }
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+
+    for (size_t t = 0; t < threads; t++)
+    {
+        result.queryTime.insert(result.queryTime.end(), times[t].begin(), times[t].end());
+        result.success += success[t];
+    }
+
+    delete filter;
+
+    return result;
+}
+
+// drops the pages of the file from the page cache, so that the next load reads it from disk
+static void dropCache(const std::string& path)
+{
+#if defined(__unix__)
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd >= 0)
+    {
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+#endif
+}
+
+testResult evaluateLoad(std::vector<std::string>* data, size_t repeat, std::string id, std::string name) {
+    testResult result;
+    result.id = std::move(id);
+    result.name = std::move(name);
+    result.keysNum = data->size();
+
+    osiris::OsirisFilter* filter = osiris::build(*data);
+    size_t size = filter->serializedSize();
+    std::string path = result.name + "_load.bin";
+    {
+        std::ofstream out(path, std::ios::binary);
+        filter->serializeTo(out);
+    }
+    std::string probe = (*data)[data->size() / 2];
+
+    for (size_t i = 0; i < repeat; i++)
+    {
+        // copy: the whole file is read and every dictionary is copied out of the buffer
+        dropCache(path);
+        auto copyStart = std::chrono::high_resolution_clock::now();
+        std::ifstream in(path, std::ios::binary);
+        auto* buffer = new uint8_t[size];
+        in.read((char*)buffer, (std::streamsize)size);
+        auto* copy = osiris::deserialize(buffer);
+        bool copyFound = copy->pointQuery(probe);
+        auto copyEnd = std::chrono::high_resolution_clock::now();
+
+        // view: the file is mapped, the small sections are copied and the pages of the large ones are read
+        // by the queries that touch them
+        dropCache(path);
+        auto viewStart = std::chrono::high_resolution_clock::now();
+        auto* view = osiris::OsirisFilterView::open(path);
+        bool viewFound = view->pointQuery(probe);
+        auto viewEnd = std::chrono::high_resolution_clock::now();
+
+        result.deserializationTime.push_back((copyEnd - copyStart).count());
+        result.viewTime.push_back((viewEnd - viewStart).count());
+        result.success += copyFound && viewFound;
+
+        delete view;
+        delete copy;
+        delete[] buffer;
+    }
+
+    delete filter;
+    std::remove(path.c_str());
+
+    return result;
+}
+
 void saveQueryReport(std::vector<testResult>& result, const std::string& filename)
 {
     std::ofstream out(filename + "_queries" + ".csv");
@@ -338,4 +555,32 @@ void saveSerialReport(std::vector<testResult>& result, const std::string& filena
         }
     }
     out.close();
+}
+
+void saveLoadReport(std::vector<testResult>& result, const std::string& filename)
+{
+    std::ofstream out(filename + "_load" + ".csv");
+    out << "Id,Number of Keys,Copy Time,View Time\n";
+    for (auto& x : result)
+    {
+        for (size_t i = 0; i < x.viewTime.size(); i++)
+        {
+            out << x.id << "," << x.keysNum << "," << x.deserializationTime[i] << "," << x.viewTime[i] << "\n";
+        }
+    }
+    out.close();
+}
+
+void saveRetryReport(std::vector<testResult>& result, const std::string& filename)
+{
+    std::ofstream out(filename + "_retries" + ".csv");
+    out << "Id,Number of Keys,Time,Retries\n";
+    for (auto& x : result)
+    {
+        for (size_t i = 0; i < x.buildRetries.size(); i++)
+        {
+            out << x.id << "," << x.keysNum << "," << x.buildTime[i] << "," << x.buildRetries[i] << "\n";
+        }
+    }
+    out.close();
 }
\ No newline at end of file
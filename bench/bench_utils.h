@@ -25,6 +25,7 @@
 #include <random>
 #include <chrono>
 #include "../include/osiris.h"
+#include "../include/replicated_filter.h"
 
 // setting specific hash_seed to reproduce the same data for testing
 static std::mt19937 rngBench(100);
@@ -79,6 +80,10 @@ testDataRange prepareRangeTest(size_t size, size_t minLen, size_t maxLen, int se
 
 std::set<std::string, cmp> generateData(size_t size, size_t minLen, size_t maxLen, int setType);
 
+// key sets with regular structure: 0 - sequential 8-byte big-endian ids, 1 - decimal ids without padding,
+// 2 - 16-byte keys whose bits are the bits of the id spread one per byte
+std::set<std::string, cmp> generateStructuredData(size_t size, int setType);
+
 struct testResult {
     std::string id;
     std::string name;
@@ -87,9 +92,13 @@ struct testResult {
 
     std::vector<long long> serializationTime;
     std::vector<long long> deserializationTime;
+    // time to open the serialized filter as a view, see evaluateLoad
+    std::vector<long long> viewTime;
 
     std::vector<long long> queryTime;
     size_t success = 0;
+
+    std::vector<size_t> buildRetries;
 };
 
 void saveQueryReport(std::vector<testResult>& result, const std::string& filename);
@@ -98,7 +107,23 @@ void saveBuildReport(std::vector<testResult>& result, const std::string& filenam
 
 void saveSerialReport(std::vector<testResult>& result, const std::string& filename);
 
+void saveRetryReport(std::vector<testResult>& result, const std::string& filename);
+
+void saveLoadReport(std::vector<testResult>& result, const std::string& filename);
+
 testResult evaluatePoint(testDataPoint* testData, size_t repeat, std::string id, std::string name, bool verify = true);
 
 testResult evaluateRange(testDataRange* testData, size_t repeat, std::string id, std::string name, bool verify = true);
+
+testResult evaluatePointBatch(testDataPoint* testData, size_t batchSize, std::string id, std::string name, bool verify = true);
+
+// builds the filter several times, recording the build time and the number of rejected seeds
+testResult evaluateBuild(std::vector<std::string>* data, size_t repeat, std::string id, std::string name);
+
+// loads a serialized filter from a file by copying it and as a view, both up to the first answered query
+testResult evaluateLoad(std::vector<std::string>* data, size_t repeat, std::string id, std::string name);
+
+// queries one shared filter from several threads at once, or its copies on every NUMA node with replicate
+testResult evaluatePointConcurrent(testDataPoint* testData, size_t threads, std::string id, std::string name, bool verify = true,
+                                   bool replicate = false);
 #endif //OSIRISFILTER_BENCH_UTILS_H
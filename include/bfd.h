@@ -20,6 +20,8 @@
 #define OSIRIS_DICTIONARY_H
 
 #include "bfd_utils.h"
+#include "sections.h"
+#include <atomic>
 
 namespace osiris
 {
@@ -28,29 +30,52 @@ namespace osiris
     protected:
         uint8_t* data;
         DataLayout layout;
-
-        // bytes for internal purposes
+        // cells of a view point into the buffer it was loaded from, which the dictionary does not own
+        bool owns_data = true;
+        // the cells are borrowed from a mapped file whose pages are mostly on disk
+        bool on_disk = false;
+        // one bit for each page of the cells, set once the page is requested from the kernel. A page the kernel
+        // drops later is read again by the query that faults it in, the mark is only a hint
+        std::unique_ptr<std::atomic<uint8_t>[]> requested_pages;
+        uintptr_t first_page = 0;
+        size_t page_size = 0;
+
+        // bytes for internal purposes, used only while building; queries keep their temporaries
+        // on the stack, so a built dictionary can be read from any number of threads at once
         uint8_t* tmp = nullptr;
         uint8_t* buf = nullptr;
     public:
-        Dictionary(size_t keys, size_t bits_per_value)
+        Dictionary(size_t keys, size_t bits_per_value, bool mix_hash, uint8_t* borrowed = nullptr)
         {
-            layout = prepareLayout(keys, bits_per_value);
-            data = new uint8_t[layout.total_size_in_bytes];
+            layout = prepareLayout(keys, bits_per_value, mix_hash);
+            if (borrowed)
+            {
+                data = borrowed;
+                owns_data = false;
+            }
+            else
+            {
+                // the padding lets cells at the end be read by whole words, it is never serialized
+                data = new uint8_t[layout.total_size_in_bytes + OSIRIS_DICTIONARY_PADDING];
+                memset(data + layout.total_size_in_bytes, 0, OSIRIS_DICTIONARY_PADDING);
+            }
             tmp = new uint8_t[BITS_TO_BYTES(bits_per_value)];
             buf = new uint8_t[BITS_TO_BYTES(bits_per_value)];
         }
 
         virtual ~Dictionary()
         {
-            delete[] data;
+            if (owns_data)
+            {
+                delete[] data;
+            }
             delete[] tmp;
             delete[] buf;
         }
 
         virtual void populate(std::pair<location_t, uint8_t*>* vals, size_t* pos, size_t* id) = 0;
 
-        virtual void getData(size_t pos, uint8_t* to) = 0;
+        virtual void getData(size_t pos, uint8_t* to) const = 0;
         virtual void setData(size_t pos, uint8_t* from) = 0;
     public:
 
@@ -138,21 +163,101 @@ namespace osiris
             return true;
         }
 
-        virtual void get(hash_t hash, uint8_t* result) = 0;
+        // restores the value stored for the already computed location of a key
+        virtual void retrieve(const location_t& loc, uint8_t* result) const = 0;
+
+        void get(hash_t hash, uint8_t* result) const
+        {
+            retrieve(hashToLocation(hash, layout), result);
+        }
+
+        location_t locate(hash_t hash) const
+        {
+            return hashToLocation(hash, layout);
+        }
+
+        // Issues loads for the cells of the location without waiting for them. Cells on disk have their pages
+        // requested from the kernel instead, which reads them in the background, so a batch query has the reads
+        // of all its lanes in flight at once instead of faulting the pages in one after another
+        void prefetch(const location_t& loc) const
+        {
+            for (size_t i = 0; i < 4; ++i)
+            {
+                const uint8_t* cell = data + ((cellIndex(loc, i, layout) * layout.len_in_bits) >> 3);
+                if (on_disk)
+                {
+                    requestPage(cell);
+                }
+                else
+                {
+                    OSIRIS_PREFETCH(cell);
+                }
+            }
+        }
 
-        size_t getSerializationSize()
+        // the cells stay in the mapped file they are borrowed from and are read from disk as the queries need them
+        void keepOnDisk()
         {
-            return sizeof(layout.keys) + sizeof(layout.len_in_bits) + layout.total_size_in_bytes;
+#if defined(__unix__) || defined(__APPLE__)
+            if (owns_data)
+            {
+                return;
+            }
+            page_size = sysconf(_SC_PAGESIZE);
+            first_page = (uintptr_t)data & ~(page_size - 1);
+            size_t pages = ((uintptr_t)data + layout.total_size_in_bytes - first_page) / page_size + 1;
+            requested_pages.reset(new std::atomic<uint8_t>[(pages + 7) / 8]);
+            for (size_t i = 0; i < (pages + 7) / 8; ++i)
+            {
+                requested_pages[i].store(0, std::memory_order_relaxed);
+            }
+            on_disk = true;
+#endif
         }
 
-        uint8_t* serialize(uint8_t* buf)
+        // asks the kernel to read the page of the address, unless it has been asked already
+        void requestPage(const uint8_t* address) const
         {
-            memmove(buf, &layout.keys, sizeof(layout.keys));
-            buf += sizeof(layout.keys);
+#if defined(__unix__) || defined(__APPLE__)
+            uintptr_t start = (uintptr_t)address & ~(page_size - 1);
+            size_t page = (start - first_page) / page_size;
+            uint8_t bit = 1u << (page & 7);
+            std::atomic<uint8_t>& requested = requested_pages[page >> 3];
+            // pages of the top levels of the trie are hit by almost every query, so the mark is checked
+            // before it is set, and their cache lines stay shared between the threads
+            if (!(requested.load(std::memory_order_relaxed) & bit) &&
+                !(requested.fetch_or(bit, std::memory_order_relaxed) & bit))
+            {
+                madvise((void*)start, page_size, MADV_WILLNEED);
+            }
+#endif
+        }
+
+        // key counts are stored in 32 bits, larger ones follow this mark in 64 bits
+        static constexpr uint32_t OSIRIS_WIDE_KEY_COUNT = UINT32_MAX;
+
+        // size in the metadata of a sectioned stream, the cells take a section of their own
+        size_t getSerializationSize() const
+        {
+            size_t count_size = layout.keys < OSIRIS_WIDE_KEY_COUNT ? sizeof(uint32_t) : sizeof(uint32_t) + sizeof(uint64_t);
+            return count_size + sizeof(layout.len_in_bits) + sizeof(uint32_t);
+        }
+
+        uint8_t* serialize(uint8_t* buf, SectionSink& sections) const
+        {
+            uint32_t keys = layout.keys < OSIRIS_WIDE_KEY_COUNT ? (uint32_t)layout.keys : OSIRIS_WIDE_KEY_COUNT;
+            memmove(buf, &keys, sizeof(keys));
+            buf += sizeof(keys);
+            if (keys == OSIRIS_WIDE_KEY_COUNT)
+            {
+                memmove(buf, &layout.keys, sizeof(layout.keys));
+                buf += sizeof(layout.keys);
+            }
             memmove(buf, &layout.len_in_bits, sizeof(layout.len_in_bits));
             buf += sizeof(layout.len_in_bits);
-            memmove(buf, data, layout.total_size_in_bytes);
-            buf += layout.total_size_in_bytes;
+            uint32_t section = sections.add(OSIRIS_SECTION_DICTIONARY, data, layout.total_size_in_bytes);
+            memmove(buf, &section, sizeof(section));
+            buf += sizeof(section);
             return buf;
         }
 
@@ -170,13 +275,13 @@ namespace osiris
             {
                 p--;
 
-                uint32_t v = id[p];
+                size_t v = id[p];
                 uint64_t u = pos[p];
 
                 buf[0] = vals[v].second[0];
-                for (size_t i : vals[v].first.position)
+                for (size_t i = 0; i < 4; ++i)
                 {
-                    getData(i, tmp);
+                    getData(cellIndex(vals[v].first, i, layout), tmp);
                     buf[0] ^= tmp[0];
                 }
                 buf[0] &= 1;
@@ -184,19 +289,19 @@ namespace osiris
             }
         }
 
-        void get(hash_t hash, uint8_t* result) override
+        void retrieve(const location_t& loc, uint8_t* result) const override
         {
-            auto loc = hashToLocation(hash, layout);
-            getData(loc.position[0], result);
+            uint8_t value;
+            getData(cellIndex(loc, 0, layout), result);
             for (int it = 1; it < 4; ++it)
             {
-                getData(loc.position[it], tmp);
-                result[0] ^= tmp[0];
+                getData(cellIndex(loc, it, layout), &value);
+                result[0] ^= value;
             }
             result[0] &= 1;
         }
 
-        void getData(size_t pos, uint8_t* to) override
+        void getData(size_t pos, uint8_t* to) const override
         {
             to[0] = (data[pos >> 3] >> (pos & 7));
         }
@@ -209,13 +314,17 @@ namespace osiris
         }
     public:
 
-        BitDictionary(uint32_t keys, uint32_t bits_per_key) : Dictionary(keys, bits_per_key) {}
+        BitDictionary(size_t keys, uint32_t bits_per_key, bool mix_hash = false, uint8_t* borrowed = nullptr)
+            : Dictionary(keys, bits_per_key, mix_hash, borrowed) {}
 
-        static std::pair<BitDictionary*, uint8_t*> deserialize(uint32_t keys, uint32_t bits_per_key, uint8_t* buf)
+        static std::pair<BitDictionary*, uint8_t*> deserialize(size_t keys, uint32_t bits_per_key, uint8_t* buf, bool mix_hash, bool borrow = false)
         {
-            auto* res = new BitDictionary(keys, bits_per_key);
+            auto* res = new BitDictionary(keys, bits_per_key, mix_hash, borrow ? buf : nullptr);
 
-            memmove(res->data, buf, res->layout.total_size_in_bytes);
+            if (!borrow)
+            {
+                memmove(res->data, buf, res->layout.total_size_in_bytes);
+            }
             buf += res->layout.total_size_in_bytes;
             return { res, buf };
         }
@@ -234,13 +343,13 @@ namespace osiris
             {
                 p--;
 
-                uint32_t v = id[p];
+                size_t v = id[p];
                 uint64_t u = pos[p];
 
                 buf[0] = vals[v].second[0];
-                for (size_t i : vals[v].first.position)
+                for (size_t i = 0; i < 4; ++i)
                 {
-                    getData(i, tmp);
+                    getData(cellIndex(vals[v].first, i, layout), tmp);
                     buf[0] ^= tmp[0];
                 }
                 buf[0] &= 3;
@@ -248,19 +357,19 @@ namespace osiris
             }
         }
 
-        void get(hash_t hash, uint8_t* result) override
+        void retrieve(const location_t& loc, uint8_t* result) const override
         {
-            auto loc = hashToLocation(hash, layout);
-            getData(loc.position[0], result);
+            uint8_t value;
+            getData(cellIndex(loc, 0, layout), result);
             for (int it = 1; it < 4; ++it)
             {
-                getData(loc.position[it], tmp);
-                result[0] ^= tmp[0];
+                getData(cellIndex(loc, it, layout), &value);
+                result[0] ^= value;
             }
             result[0] &= 3;
         }
 
-        void getData(size_t pos, uint8_t* to) override
+        void getData(size_t pos, uint8_t* to) const override
         {
             to[0] = (data[pos >> 2] >> ((pos & 3) << 1));
         }
@@ -273,13 +382,17 @@ namespace osiris
 
     public:
 
-        TwoBitDictionary(uint32_t keys, uint32_t bits_per_key) : Dictionary(keys, bits_per_key) {}
+        TwoBitDictionary(size_t keys, uint32_t bits_per_key, bool mix_hash = false, uint8_t* borrowed = nullptr)
+            : Dictionary(keys, bits_per_key, mix_hash, borrowed) {}
 
-        static std::pair<TwoBitDictionary*, uint8_t*> deserialize(uint32_t keys, uint32_t bits_per_key, uint8_t* buf)
+        static std::pair<TwoBitDictionary*, uint8_t*> deserialize(size_t keys, uint32_t bits_per_key, uint8_t* buf, bool mix_hash, bool borrow = false)
         {
-            auto* res = new TwoBitDictionary(keys, bits_per_key);
+            auto* res = new TwoBitDictionary(keys, bits_per_key, mix_hash, borrow ? buf : nullptr);
 
-            memmove(res->data, buf, res->layout.total_size_in_bytes);
+            if (!borrow)
+            {
+                memmove(res->data, buf, res->layout.total_size_in_bytes);
+            }
             buf += res->layout.total_size_in_bytes;
             return { res, buf };
         }
@@ -298,13 +411,13 @@ namespace osiris
             {
                 p--;
 
-                uint32_t v = id[p];
+                size_t v = id[p];
                 uint64_t u = pos[p];
 
                 buf[0] = vals[v].second[0];
-                for (size_t i : vals[v].first.position)
+                for (size_t i = 0; i < 4; ++i)
                 {
-                    getData(i, tmp);
+                    getData(cellIndex(vals[v].first, i, layout), tmp);
                     buf[0] ^= tmp[0];
                 }
                 buf[0] &= 15;
@@ -312,19 +425,19 @@ namespace osiris
             }
         }
 
-        void get(hash_t hash, uint8_t* result) override
+        void retrieve(const location_t& loc, uint8_t* result) const override
         {
-            auto loc = hashToLocation(hash, layout);
-            getData(loc.position[0], result);
+            uint8_t value;
+            getData(cellIndex(loc, 0, layout), result);
             for (int it = 1; it < 4; ++it)
             {
-                getData(loc.position[it], tmp);
-                result[0] ^= tmp[0];
+                getData(cellIndex(loc, it, layout), &value);
+                result[0] ^= value;
             }
             result[0] &= 15;
         }
 
-        void getData(size_t pos, uint8_t* to) override
+        void getData(size_t pos, uint8_t* to) const override
         {
             to[0] = (data[pos >> 1] >> ((pos & 1) << 2));
         }
@@ -337,13 +450,17 @@ namespace osiris
 
     public:
 
-        FourBitDictionary(uint32_t keys, uint32_t bits_per_key) : Dictionary(keys, bits_per_key) {}
+        FourBitDictionary(size_t keys, uint32_t bits_per_key, bool mix_hash = false, uint8_t* borrowed = nullptr)
+            : Dictionary(keys, bits_per_key, mix_hash, borrowed) {}
 
-        static std::pair<FourBitDictionary*, uint8_t*> deserialize(uint32_t keys, uint32_t bits_per_key, uint8_t* buf)
+        static std::pair<FourBitDictionary*, uint8_t*> deserialize(size_t keys, uint32_t bits_per_key, uint8_t* buf, bool mix_hash, bool borrow = false)
         {
-            auto* res = new FourBitDictionary(keys, bits_per_key);
+            auto* res = new FourBitDictionary(keys, bits_per_key, mix_hash, borrow ? buf : nullptr);
 
-            memmove(res->data, buf, res->layout.total_size_in_bytes);
+            if (!borrow)
+            {
+                memmove(res->data, buf, res->layout.total_size_in_bytes);
+            }
             buf += res->layout.total_size_in_bytes;
             return { res, buf };
         }
@@ -362,14 +479,14 @@ namespace osiris
             {
                 p--;
 
-                uint32_t v = id[p];
+                size_t v = id[p];
                 uint64_t u = pos[p];
 
                 memcpy(buf, vals[v].second, layout.len_in_bytes);
 
-                for (size_t i : vals[v].first.position)
+                for (size_t i = 0; i < 4; ++i)
                 {
-                    getData(i, tmp);
+                    getData(cellIndex(vals[v].first, i, layout), tmp);
                     for (size_t pt = 0; pt < layout.len_in_bytes; ++pt)
                     {
                         buf[pt] ^= tmp[pt];
@@ -379,23 +496,22 @@ namespace osiris
             }
         }
 
-        void get(hash_t hash, uint8_t* result) override
+        void retrieve(const location_t& loc, uint8_t* result) const override
         {
-            auto loc = hashToLocation(hash, layout);
             if (layout.len_in_bytes == 1)
             {
-                uint8_t a = data[loc.position[0]];
-                uint8_t b = data[loc.position[1]];
-                uint8_t c = data[loc.position[2]];
-                uint8_t d = data[loc.position[3]];
+                uint8_t a = data[cellIndex(loc, 0, layout)];
+                uint8_t b = data[cellIndex(loc, 1, layout)];
+                uint8_t c = data[cellIndex(loc, 2, layout)];
+                uint8_t d = data[cellIndex(loc, 3, layout)];
 
                 result[0] = a ^ b ^ c ^ d;
                 return;
             }
 
-            memmove(result, data + loc.position[0] * layout.len_in_bytes, layout.len_in_bytes);
+            memmove(result, data + cellIndex(loc, 0, layout) * layout.len_in_bytes, layout.len_in_bytes);
             size_t off;
-            size_t s1 = loc.position[1] * layout.len_in_bytes;
+            size_t s1 = cellIndex(loc, 1, layout) * layout.len_in_bytes;
             for (off = 0; off + 3 < layout.len_in_bytes; off += 4)
             {
                 result[off + 0] ^= data[s1 + off];
@@ -409,7 +525,7 @@ namespace osiris
                 off++;
             }
 
-            s1 = loc.position[2] * layout.len_in_bytes;
+            s1 = cellIndex(loc, 2, layout) * layout.len_in_bytes;
 
             for (off = 0; off + 3 < layout.len_in_bytes; off += 4)
             {
@@ -424,7 +540,7 @@ namespace osiris
                 off++;
             }
 
-            s1 = loc.position[3] * layout.len_in_bytes;
+            s1 = cellIndex(loc, 3, layout) * layout.len_in_bytes;
 
             for (off = 0; off + 3 < layout.len_in_bytes; off += 4)
             {
@@ -440,7 +556,7 @@ namespace osiris
             }
         }
 
-        void getData(size_t pos, uint8_t* to) override
+        void getData(size_t pos, uint8_t* to) const override
         {
             memmove(to, data + pos * layout.len_in_bytes, layout.len_in_bytes);
         }
@@ -452,53 +568,208 @@ namespace osiris
 
     public:
 
-        ByteDictionary(uint32_t keys, uint32_t bits_per_key) : Dictionary(keys, bits_per_key) {}
+        ByteDictionary(size_t keys, uint32_t bits_per_key, bool mix_hash = false, uint8_t* borrowed = nullptr)
+            : Dictionary(keys, bits_per_key, mix_hash, borrowed) {}
 
-        static std::pair<ByteDictionary*, uint8_t*> deserialize(uint32_t keys, uint32_t bits_per_key, uint8_t* buf)
+        static std::pair<ByteDictionary*, uint8_t*> deserialize(size_t keys, uint32_t bits_per_key, uint8_t* buf, bool mix_hash, bool borrow = false)
         {
-            auto* res = new ByteDictionary(keys, bits_per_key);
+            auto* res = new ByteDictionary(keys, bits_per_key, mix_hash, borrow ? buf : nullptr);
 
-            memmove(res->data, buf, res->layout.total_size_in_bytes);
+            if (!borrow)
+            {
+                memmove(res->data, buf, res->layout.total_size_in_bytes);
+            }
             buf += res->layout.total_size_in_bytes;
             return { res, buf };
         }
     };
 
-    inline Dictionary* initDictionary(size_t keys, size_t bits_per_entry)
+    // cells of any width up to 64 bits packed one after another, a cell is read by a single unaligned word load
+    // (and one more byte if it crosses the word)
+    class PackedDictionary : public Dictionary
+    {
+        uint64_t valueMask() const
+        {
+            return layout.len_in_bits == 64 ? ~0ull : (1ull << layout.len_in_bits) - 1;
+        }
+
+        uint64_t cell(size_t pos) const
+        {
+            size_t bit = pos * layout.len_in_bits;
+            size_t shift = bit & 7;
+            uint64_t word;
+            memcpy(&word, data + (bit >> 3), sizeof(word));
+            uint64_t value = word >> shift;
+            if (shift + layout.len_in_bits > 64)
+            {
+                value |= (uint64_t)data[(bit >> 3) + 8] << (64 - shift);
+            }
+            return value & valueMask();
+        }
+
+        void setCell(size_t pos, uint64_t value)
+        {
+            size_t bit = pos * layout.len_in_bits;
+            size_t shift = bit & 7;
+            uint64_t word;
+            memcpy(&word, data + (bit >> 3), sizeof(word));
+            word = (word & ~(valueMask() << shift)) | (value << shift);
+            memcpy(data + (bit >> 3), &word, sizeof(word));
+            if (shift + layout.len_in_bits > 64)
+            {
+                uint8_t high_mask = (1u << (shift + layout.len_in_bits - 64)) - 1;
+                uint8_t& high = data[(bit >> 3) + 8];
+                high = (high & ~high_mask) | (uint8_t)(value >> (64 - shift));
+            }
+        }
+
+        void populate(std::pair<location_t, uint8_t*>* vals, size_t* pos, size_t* id) override
+        {
+            memset(this->data, 0, this->layout.total_size_in_bytes);
+
+            size_t p = layout.keys;
+
+            while (p)
+            {
+                p--;
+
+                size_t v = id[p];
+                uint64_t u = pos[p];
+
+                uint64_t value = 0;
+                memcpy(&value, vals[v].second, layout.len_in_bytes);
+                for (size_t i = 0; i < 4; ++i)
+                {
+                    value ^= cell(cellIndex(vals[v].first, i, layout));
+                }
+                setCell(u, value & valueMask());
+            }
+        }
+
+        void retrieve(const location_t& loc, uint8_t* result) const override
+        {
+            uint64_t value = cell(cellIndex(loc, 0, layout)) ^ cell(cellIndex(loc, 1, layout)) ^
+                             cell(cellIndex(loc, 2, layout)) ^ cell(cellIndex(loc, 3, layout));
+            memcpy(result, &value, layout.len_in_bytes);
+        }
+
+        void getData(size_t pos, uint8_t* to) const override
+        {
+            uint64_t value = cell(pos);
+            memcpy(to, &value, layout.len_in_bytes);
+        }
+
+        void setData(size_t pos, uint8_t* from) override
+        {
+            uint64_t value = 0;
+            memcpy(&value, from, layout.len_in_bytes);
+            setCell(pos, value & valueMask());
+        }
+
+    public:
+
+        PackedDictionary(size_t keys, uint32_t bits_per_key, bool mix_hash = false, uint8_t* borrowed = nullptr)
+            : Dictionary(keys, bits_per_key, mix_hash, borrowed) {}
+
+        static std::pair<PackedDictionary*, uint8_t*> deserialize(size_t keys, uint32_t bits_per_key, uint8_t* buf, bool mix_hash, bool borrow = false)
+        {
+            auto* res = new PackedDictionary(keys, bits_per_key, mix_hash, borrow ? buf : nullptr);
+
+            if (!borrow)
+            {
+                memmove(res->data, buf, res->layout.total_size_in_bytes);
+            }
+            buf += res->layout.total_size_in_bytes;
+            return { res, buf };
+        }
+    };
+
+    // widths that are neither 1, 2, 4 nor whole bytes are packed
+    inline bool isPackedWidth(size_t bits_per_entry)
+    {
+        return (bits_per_entry & 7) && bits_per_entry < 64;
+    }
+
+    // cells --- memory of prepareLayout(keys, bits_per_entry).total_size_in_bytes followed by the padding,
+    // which the dictionary uses instead of its own, nullptr --- the dictionary allocates it
+    inline Dictionary* initDictionary(size_t keys, size_t bits_per_entry, bool mix_hash = false, uint8_t* cells = nullptr)
     {
         switch (bits_per_entry)
         {
             case 1:
-                return new BitDictionary(keys, bits_per_entry);
+                return new BitDictionary(keys, bits_per_entry, mix_hash, cells);
             case 2:
-                return new TwoBitDictionary(keys, bits_per_entry);
+                return new TwoBitDictionary(keys, bits_per_entry, mix_hash, cells);
             case 4:
-                return new FourBitDictionary(keys, bits_per_entry);
+                return new FourBitDictionary(keys, bits_per_entry, mix_hash, cells);
             default:
-                return new ByteDictionary(keys, bits_per_entry);
+                if (isPackedWidth(bits_per_entry))
+                {
+                    return new PackedDictionary(keys, bits_per_entry, mix_hash, cells);
+                }
+                return new ByteDictionary(keys, bits_per_entry, mix_hash, cells);
         }
     }
 
-    inline std::pair<Dictionary*, uint8_t*> deserializeDictionary(uint8_t* buf)
+    // Reads the dictionary whose metadata is at buf, from a v1 stream, where the cells follow, or from a sectioned one.
+    // A dictionary of a view keeps its cells in the stream. Packed cells are read by whole words though,
+    // so a packed dictionary too close to the end of a v1 stream is copied instead. The dictionary is nullptr
+    // if the metadata names a section the stream does not have
+    inline std::pair<Dictionary*, uint8_t*> deserializeDictionary(uint8_t* buf, bool mix_hash = false,
+                                                                  const SerialSource& source = SerialSource())
     {
-        uint32_t keys;
+        uint32_t short_keys;
         uint32_t bits_per_entry;
-        memmove(&keys, buf, sizeof(keys));
-        buf += sizeof(keys);
+        memmove(&short_keys, buf, sizeof(short_keys));
+        buf += sizeof(short_keys);
+        uint64_t keys = short_keys;
+        if (short_keys == Dictionary::OSIRIS_WIDE_KEY_COUNT)
+        {
+            memmove(&keys, buf, sizeof(keys));
+            buf += sizeof(keys);
+        }
         memmove(&bits_per_entry, buf, sizeof(bits_per_entry));
         buf += sizeof(bits_per_entry);
 
+        size_t size = prepareLayout(keys, bits_per_entry).total_size_in_bytes;
+        uint8_t* cells = source.payload(buf, size);
+        if (!cells)
+        {
+            return { nullptr, buf };
+        }
+        bool borrow = source.view_end != nullptr && size > source.eager_bytes;
+        if (borrow && isPackedWidth(bits_per_entry))
+        {
+            borrow = (size_t)(source.view_end - cells) >= size + OSIRIS_DICTIONARY_PADDING;
+        }
+
+        Dictionary* result;
         switch (bits_per_entry)
         {
             case 1:
-                return BitDictionary::deserialize(keys, bits_per_entry, buf);
+                result = BitDictionary::deserialize(keys, bits_per_entry, cells, mix_hash, borrow).first;
+                break;
             case 2:
-                return TwoBitDictionary::deserialize(keys, bits_per_entry, buf);
+                result = TwoBitDictionary::deserialize(keys, bits_per_entry, cells, mix_hash, borrow).first;
+                break;
             case 4:
-                return FourBitDictionary::deserialize(keys, bits_per_entry, buf);
+                result = FourBitDictionary::deserialize(keys, bits_per_entry, cells, mix_hash, borrow).first;
+                break;
             default:
-                return ByteDictionary::deserialize(keys, bits_per_entry, buf);
+                if (isPackedWidth(bits_per_entry))
+                {
+                    result = PackedDictionary::deserialize(keys, bits_per_entry, cells, mix_hash, borrow).first;
+                }
+                else
+                {
+                    result = ByteDictionary::deserialize(keys, bits_per_entry, cells, mix_hash, borrow).first;
+                }
+        }
+        if (source.on_disk)
+        {
+            result->keepOnDisk();
         }
+        return { result, buf };
     }
 
 }
@@ -43,19 +43,24 @@ namespace osiris
 		uint64_t total_pages = 0;
 
 		// number of keys in the dictionary
-		uint32_t keys = 0;
+		uint64_t keys = 0;
 
 		uint32_t len_in_bits = 0;
 		uint32_t len_in_bytes = 0;
 
 		// binary log of the segment length
 		uint32_t segment_length_log = 0;
+
+		// locations are taken from the mixed hash, otherwise from the hash as it is
+		bool mix_hash = false;
 	};
 
-	inline DataLayout prepareLayout(size_t keys, size_t length_in_bits)
+	inline DataLayout prepareLayout(size_t keys, size_t length_in_bits, bool mix_hash = false)
 	{
 		DataLayout result;
 
+		result.mix_hash = mix_hash;
+
 		result.keys = keys;
 
 		result.segment_length_log = calculateSegmentLengthLog(keys);
@@ -68,7 +73,7 @@ namespace osiris
 		auto capacity = (size_t)((double)keys * sizeFactor);
 
 		// capacity rounded up to the closest
-		size_t segmentCount = std::max(4ull, (capacity + result.segment_length - 1) / result.segment_length);
+		size_t segmentCount = std::max((size_t)4, (capacity + result.segment_length - 1) / result.segment_length);
 
 		result.segments_count = segmentCount - 3;
 		result.total_segments = segmentCount;
@@ -83,23 +88,39 @@ namespace osiris
 		return result;
 	}
 
-	inline location_t hashToLocation(hash_t hash, DataLayout& layout)
+	inline location_t hashToLocation(hash_t hash, const DataLayout& layout)
 	{
 		location_t res;
 		size_t lengthLog = layout.segment_length_log;
 		size_t segmentMask = layout.segment_mask;
-		res.first_bucket = (hash >> lengthLog) % layout.segments_count;
-
-		size_t offset = ((size_t)res.first_bucket) << lengthLog;
+		if (layout.mix_hash)
+		{
+			// node hashes of a trie are xor-combinations of a few seeds, so they are spread
+			// before use, and the bucket is picked by the high bits instead of a division.
+			// The positions below take the high bits too, so they come from a scrambled copy
+			hash = mix64(hash);
+			res.first_bucket = mulHigh(hash, layout.segments_count);
+			hash *= 0x9e3779b97f4a7c15ull;
+		}
+		else
+		{
+			res.first_bucket = (hash >> lengthLog) % layout.segments_count;
+		}
 
-		res.position[0] = (hash & segmentMask) + offset;
-		res.position[1] = (rotl64(hash, (uint32_t)(lengthLog)) & segmentMask) + (1ULL << lengthLog) + offset;
-		res.position[2] = (rotl64(hash, (uint32_t)(2ull * lengthLog)) & segmentMask) + (2ULL << lengthLog) + offset;
-		res.position[3] = (rotl64(hash, (uint32_t)(3ull * lengthLog)) & segmentMask) + (3ULL << lengthLog) + offset;
+		res.position[0] = hash & segmentMask;
+		res.position[1] = (rotl64(hash, (uint32_t)(lengthLog)) & segmentMask) + (1ULL << lengthLog);
+		res.position[2] = (rotl64(hash, (uint32_t)(2ull * lengthLog)) & segmentMask) + (2ULL << lengthLog);
+		res.position[3] = (rotl64(hash, (uint32_t)(3ull * lengthLog)) & segmentMask) + (3ULL << lengthLog);
 
 		return res;
 	}
 
+	// index of the cell the position of the location points to
+	inline uint64_t cellIndex(const location_t& loc, size_t i, const DataLayout& layout)
+	{
+		return (((uint64_t)loc.first_bucket) << layout.segment_length_log) + loc.position[i];
+	}
+
 	inline bool peel(
 		std::pair<location_t, uint8_t*>* info, size_t size,
 		size_t* pos, size_t* id, size_t* sets, size_t* st, DataLayout& data_layout)
@@ -107,7 +128,7 @@ namespace osiris
 		size_t p = 0;
 
 		// sort goes here
-		radixSortBucket(info, size);
+		radixSortBucket(info, size, data_layout.segments_count);
 
 		/*std::sort(info, info + size, [](std::pair<location_t, uint8_t*>& l, std::pair<location_t, uint8_t*>& r)
 		{
@@ -118,8 +139,9 @@ namespace osiris
 
 		for (size_t it = 0; it < size; ++it)
 		{
-			for (size_t i : info[it].first.position)
+			for (size_t k = 0; k < 4; ++k)
 			{
+				uint64_t i = cellIndex(info[it].first, k, data_layout);
 				sets[i << 1]++;
 				sets[i << 1 | 1] ^= it;
 			}
@@ -148,8 +170,9 @@ namespace osiris
 			id[p] = v;
 			p++;
 
-			for (size_t it : info[v].first.position)
+			for (size_t k = 0; k < 4; ++k)
 			{
+				uint64_t it = cellIndex(info[v].first, k, data_layout);
 				sets[it << 1]--;
 				sets[it << 1 | 1] ^= v;
 				if (sets[it << 1] == 1)
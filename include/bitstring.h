@@ -32,10 +32,11 @@ namespace osiris
 	{
 	private:
 
-		inline static uint8_t* buf = nullptr;
+		// the scratch buffer of the build running on the thread, so filters can be built on several threads at once
+		inline static thread_local uint8_t* buf = nullptr;
 
-        inline static size_t buf_size = 0;
-        inline static size_t next = 0;
+        inline static thread_local size_t buf_size = 0;
+        inline static thread_local size_t next = 0;
 
 	public:
 		size_t begin = 0;
@@ -45,17 +45,21 @@ namespace osiris
                 data.link_lengths[i].reserve(cnt + 5);
             }
 
-            bool built = false;
+            bool built = true;
 
             data.id = 0;
             hash_seed = osiris_rng();
+            data.hasher = nodeHasher();
 
             collectDataAndHashes(data, keys, 0ull, keys.size() - 1, 0ull, hash_seed, hash_seed);
 
 
             max_link_size_in_bits = data.max_link_length;
 
-            size_t length_bits = getSize(data.max_link_length);
+            // parts of the links kept apart from length[bit] and links[bit] in the optional layouts
+            LinkStorage link_storage;
+            size_t length_bits = prepareLinkStorage(data.link_lengths, data.link_chunks, 2, 0, data.max_link_length, link_storage);
+            built &= buildLinkStorage(hashes, link_storage);
 
 
             for (int i = 0; i < 2; ++i)
@@ -66,18 +70,18 @@ namespace osiris
                     {
                         links_mask[i] |= (1ull << j);
 
-                        links[i][j] = initDictionary(data.link_chunks[i][j].size(), 1ull << j);
+                        links[i][j] = newDictionary(data.link_chunks[i][j].size(), 1ull << j);
                         built &= links[i][j]->build(hashes, data.link_chunks[i][j]);
                     }
                 }
-                length[i] = initDictionary(data.link_lengths[i].size(), length_bits);
+                length[i] = newDictionary(data.link_lengths[i].size(), length_bits);
                 built &= length[i]->build(hashes, data.link_lengths[i]);
             }
 
-            endpoint_storage = initDictionary(data.is_endpoint.size(), 1);
+            endpoint_storage = newDictionary(data.is_endpoint.size(), 1);
             built &= endpoint_storage->build(hashes, data.is_endpoint);
 
-            mask_storage = initDictionary(data.link_mask.size(), 2);
+            mask_storage = newDictionary(data.link_mask.size(), 2);
             built &= mask_storage->build(hashes, data.link_mask);
 
             size_t retries = 0;
@@ -86,9 +90,11 @@ namespace osiris
             {
                 retries++;
                 hash_seed = osiris_rng();
+                data.hasher = nodeHasher();
                 data.id = 0;
                 collectHashes(data, keys, 0ull, keys.size() - 1, 0ull, hash_seed, hash_seed);
                 built = true;
+                built &= buildLinkStorage(hashes, link_storage);
                 for (int i = 0; i < 2; ++i)
                 {
                     for (int j = 0; j < 32; ++j)
@@ -105,17 +111,14 @@ namespace osiris
                 built &= mask_storage->build(hashes, data.link_mask);
             }
 
-            hash_cache[0] = nextRand(hash_seed);
-            for (int i = 1; i < OSIRIS_HASH_CACHE_SIZE; ++i)
-            {
-                hash_cache[i] = nextRand(hash_cache[i - 1]);
-            }
+            max_depth = data.max_depth;
+            initSeedCache(max_depth);
             bitstring::clear();
             delete[] hashes;
             return retries;
         }
 
-		bool pointQueryInternal(const std::string& key, uint8_t* link_buffer)
+		bool pointQueryInternal(const std::string& key, uint8_t* link_buffer) const
 		{
 			uint8_t mask = 0;
 			uint8_t is_endpoint = 0;
@@ -132,6 +135,12 @@ namespace osiris
 			uint8_t m0 = 128;
 			uint8_t m1 = 0;
 
+			// the top levels are resolved by a single lookup
+			if (!skipTopLevels(key, pos, m0, cur, s, hash_id))
+			{
+				return false;
+			}
+
 			uint8_t val = key[pos];
 			uint8_t bit;
 			uint8_t val1 = 0;
@@ -173,6 +182,8 @@ namespace osiris
 						continue;
 				}
 
+				PREFETCH_CHILDREN(cur, s, hash_id);
+
 				// check the state of the node
 				this->mask_storage->get(cur, &mask);
 
@@ -184,6 +195,11 @@ namespace osiris
 
 				// restoring next link in the set
 				link_len = extractLink(bit, cur, link_buffer);
+				// a broken link ---> no key is below the node
+				if (link_len == OSIRIS_BROKEN_LINK)
+				{
+					return false;
+				}
 				// updating hash to point to the next trie's node
 				UPDATE_HASH(cur, s, bit, hash_id, h1, h2)
 				
@@ -209,7 +225,7 @@ namespace osiris
 			return is_endpoint;
 		}
 
-		bool prefixQueryInternal(const std::string& key, uint8_t* link_buffer)
+		bool prefixQueryInternal(const std::string& key, uint8_t* link_buffer) const
 		{
 			uint8_t mask = 0;
 			uint8_t is_endpoint = 0;
@@ -226,6 +242,12 @@ namespace osiris
 			uint8_t m0 = 128;
 			uint8_t m1 = 0;
 
+			// the top levels are resolved by a single lookup
+			if (!skipTopLevels(key, pos, m0, cur, s, hash_id))
+			{
+				return false;
+			}
+
 			uint8_t val = key[pos];
 			uint8_t bit;
 			uint8_t val1 = 0;
@@ -267,6 +289,8 @@ namespace osiris
 						continue;
 				}
 
+				PREFETCH_CHILDREN(cur, s, hash_id);
+
 				// check the state of the node
 				this->mask_storage->get(cur, &mask);
 
@@ -278,6 +302,11 @@ namespace osiris
 
 				// restoring next link in the set
 				link_len = extractLink(bit, cur, link_buffer);
+				// a broken link ---> no key is below the node
+				if (link_len == OSIRIS_BROKEN_LINK)
+				{
+					return false;
+				}
 				// updating hash to point to the next trie's node
 				UPDATE_HASH(cur, s, bit, hash_id, h1, h2)
 
@@ -290,7 +319,7 @@ namespace osiris
 		bool rangeQueryInternal(
 			const std::string& left, bool include_left,
 			const std::string& right, bool include_right,
-			uint8_t* prefix_buffer, uint8_t* tail_buffer)
+			uint8_t* prefix_buffer, uint8_t* tail_buffer) const
 		{
 			size_t left_key_size = left.size();
 
@@ -362,6 +391,8 @@ namespace osiris
 					continue;
 				}
 
+				PREFETCH_CHILDREN(cur, s, hash_id);
+
 				// extract state of the node
 				this->mask_storage->get(cur, &mask);
 
@@ -389,6 +420,11 @@ namespace osiris
 
 				// otherwise update link
 				link_len = extractLink(left_bit, cur, prefix_buffer);
+				// a broken link ---> no key is below the node
+				if (link_len == OSIRIS_BROKEN_LINK)
+				{
+					return false;
+				}
 				pt = 0;
 
 				// go to the next vertex
@@ -431,7 +467,7 @@ namespace osiris
 			size_t pos, uint8_t m0,
 			hash_t cur, hash_t current_seed, int hash_id,
 			bool include_tail, bool isLeft,
-			bool can_pick, uint8_t* tail_buffer) {
+			bool can_pick, uint8_t* tail_buffer) const {
 
 			size_t key_len = key.size();
 
@@ -499,6 +535,7 @@ namespace osiris
 						continue;
 				}
 
+				PREFETCH_CHILDREN(cur, current_seed, hash_id);
 				this->mask_storage->get(cur, &mask);
 
 				// if we are not on the common prefix
@@ -534,6 +571,11 @@ namespace osiris
 
 				// restoring next link
 				link_len = extractLink(bit, cur, tail_buffer);
+				// a broken link ---> no key is below the node
+				if (link_len == OSIRIS_BROKEN_LINK)
+				{
+					return false;
+				}
 				// moving to the next node
 				UPDATE_HASH(cur, current_seed, bit, hash_id, h1, h2)
 
@@ -589,7 +631,7 @@ namespace osiris
 			size_t pos1, uint8_t m1, size_t len,
 			hash_t cur, hash_t s, int hash_id,
 			uint8_t* prefix_buffer, uint8_t* tail_buffer,
-			bool include_left)
+			bool include_left) const
 		{
 			size_t key_len = left.size();
 
@@ -644,7 +686,7 @@ namespace osiris
 			size_t pos1, uint8_t m1, size_t len,
 			hash_t cur, hash_t s, int hash_id,
 			const uint8_t* prefix_buffer, uint8_t* tail_buffer,
-			bool include_right)
+			bool include_right) const
 		{
 			size_t key_length = right.size();
 
@@ -697,44 +739,75 @@ namespace osiris
 		}
 
 
+		//////////////////////////
+		/// Batched traversal ///
+		/////////////////////////
+
+		const Dictionary* nodeStateStorage() const override
+		{
+			return mask_storage;
+		}
+
+		bool canDescend(uint8_t state, bool bit) const override
+		{
+			return state & (1 << bit);
+		}
+
+		bool pointQueryFinal(hash_t hash) const override
+		{
+			uint8_t mask = 0;
+			mask_storage->get(hash, &mask);
+			// if it is a leaf or a key's end ---> the key exists
+			if (mask != 3)
+			{
+				return true;
+			}
+			uint8_t is_endpoint = 0;
+			endpoint_storage->get(hash, &is_endpoint);
+			return is_endpoint;
+		}
+
 		//////////////////////
 		/// Serialization ///
 		/////////////////////
 
-		uint8_t getFilterId() override
+		uint8_t getFilterId() const override
 		{
 			return 3;
 		}
 
-		uint8_t* serializeExtra(uint8_t* buf) override
+		uint8_t* serializeExtra(uint8_t* buf, SectionSink& sections) const override
 		{
-			buf = mask_storage->serialize(buf);
-			buf = endpoint_storage->serialize(buf);
+			buf = mask_storage->serialize(buf, sections);
+			buf = endpoint_storage->serialize(buf, sections);
 			return buf;
 		}
 
-		size_t serializeExtraSize() override
+		size_t serializeExtraSize() const override
 		{
 			return mask_storage->getSerializationSize() + endpoint_storage->getSerializationSize();
 		}
 
 	public:
-		CommonFilter(const std::vector<std::string>& keys, KeySetInfo info)
+		CommonFilter(const std::vector<std::string>& keys, KeySetInfo info, const BuildOptions& options = BuildOptions())
 		{
-            auto retries = construct(keys, info);
-            OSIRIS_DEBUG_PRINT("retries: ", retries);
+            selectLayout(options);
+            build_retries = construct(keys, info);
+            OSIRIS_DEBUG_PRINT("retries: ", build_retries);
+            buildTopLevels(keys, options.top_level_bits);
+            buildPrefilter(keys, options.point_prefilter);
 		}
 
-		CommonFilter(uint8_t* buf)
+		CommonFilter(uint8_t* buf, const FilterHeader& header = FilterHeader())
 		{
 			// assert(buf[0] == getFilterId());
-			buf = deserializeCore(buf);
-			auto [dict1, buf1] = deserializeDictionary(buf);
+			buf = deserializeCore(buf, header);
+			auto [dict1, buf1] = loadDictionary(buf);
 
 			mask_storage = dict1;
 			buf = buf1;
 
-			auto [dict2, buf2] = deserializeDictionary(buf);
+			auto [dict2, buf2] = loadDictionary(buf);
 
 			endpoint_storage = dict2;
 		}
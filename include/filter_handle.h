@@ -0,0 +1,233 @@
+/*
+ * This file is part of OsirisFilter <https://github.com/aplyusnin/OsirisFilter>.
+ * Copyright (C) 2024 Artem Plyusnin.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OSIRIS_FILTER_HANDLE_H
+#define OSIRIS_FILTER_HANDLE_H
+
+#include "osiris.h"
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// readers of a handle that hold a filter at once without searching for a free slot, see FilterHandle
+#ifndef OSIRIS_HANDLE_SLOTS
+#define OSIRIS_HANDLE_SLOTS 64
+#endif
+
+namespace osiris
+{
+    // The current version of a filter that is replaced while it is queried. A reader takes a guard, which keeps the
+    // version it got alive, and queries it without locking. A writer publishes a new version, which the readers
+    // get from then on, and deletes the old one once no guard holds it.
+    // Each guard marks the version it holds in a slot of its own, the slot of a thread is chosen by its id, so the
+    // readers of different threads write different cache lines. publish() waits for the guards of the old version,
+    // so it must not be called by a thread that holds a guard of the same handle
+    class FilterHandle
+    {
+        struct Version
+        {
+            OsirisFilter* filter = nullptr;
+            OsirisFilterView* view = nullptr;
+
+            const OsirisFilter* get() const
+            {
+                return view ? view->get() : filter;
+            }
+
+            ~Version()
+            {
+                delete filter;
+                delete view;
+            }
+        };
+
+        struct alignas(64) Slot
+        {
+            // nullptr --- free, busy() --- taken by a guard that has not marked its version yet
+            std::atomic<Version*> version{nullptr};
+        };
+
+        std::atomic<Version*> current{nullptr};
+        mutable Slot slots[OSIRIS_HANDLE_SLOTS];
+        // publishers wait for the readers one at a time
+        std::mutex publishing;
+
+        static Version* busy()
+        {
+            static Version mark;
+            return &mark;
+        }
+
+        void replace(Version* version)
+        {
+            std::lock_guard<std::mutex> lock(publishing);
+            Version* old = current.exchange(version);
+            if (!old)
+            {
+                return;
+            }
+            // a guard that marked the old version before the exchange keeps it, the later ones get the new one
+            for (Slot& slot : slots)
+            {
+                while (slot.version.load() == old)
+                {
+                    std::this_thread::yield();
+                }
+            }
+            delete old;
+        }
+    public:
+        // A version of the filter taken from the handle, which stays alive until the guard is destroyed.
+        // A guard belongs to the thread that took it
+        class Guard
+        {
+            Slot* slot = nullptr;
+            const OsirisFilter* filter = nullptr;
+
+            friend class FilterHandle;
+
+            Guard(Slot* slot, const OsirisFilter* filter) : slot(slot), filter(filter) {}
+        public:
+            Guard(Guard&& other) noexcept : slot(other.slot), filter(other.filter)
+            {
+                other.slot = nullptr;
+                other.filter = nullptr;
+            }
+
+            Guard(const Guard&) = delete;
+            Guard& operator=(const Guard&) = delete;
+            Guard& operator=(Guard&&) = delete;
+
+            ~Guard()
+            {
+                if (slot)
+                {
+                    slot->version.store(nullptr, std::memory_order_release);
+                }
+            }
+
+            // nullptr if nothing has been published yet
+            const OsirisFilter* get() const
+            {
+                return filter;
+            }
+
+            const OsirisFilter* operator->() const
+            {
+                return filter;
+            }
+
+            explicit operator bool() const
+            {
+                return filter != nullptr;
+            }
+        };
+
+        FilterHandle() = default;
+
+        // the handle owns the filter
+        explicit FilterHandle(OsirisFilter* filter)
+        {
+            publish(filter);
+        }
+
+        explicit FilterHandle(OsirisFilterView* view)
+        {
+            publish(view);
+        }
+
+        FilterHandle(const FilterHandle&) = delete;
+        FilterHandle& operator=(const FilterHandle&) = delete;
+
+        // no guard may outlive the handle
+        ~FilterHandle()
+        {
+            delete current.load();
+        }
+
+        Guard read() const
+        {
+            size_t start = std::hash<std::thread::id>()(std::this_thread::get_id());
+            Slot* slot = nullptr;
+            // more readers than slots take turns
+            for (size_t i = start; !slot; ++i)
+            {
+                Slot& candidate = slots[i % OSIRIS_HANDLE_SLOTS];
+                Version* expected = nullptr;
+                if (candidate.version.load(std::memory_order_relaxed) == nullptr &&
+                    candidate.version.compare_exchange_strong(expected, busy()))
+                {
+                    slot = &candidate;
+                }
+                else if ((i - start + 1) % OSIRIS_HANDLE_SLOTS == 0)
+                {
+                    std::this_thread::yield();
+                }
+            }
+            // the version is marked, then checked to be still current: if it is, the writer that replaces it
+            // does so after the mark and sees it
+            Version* version = current.load();
+            while (true)
+            {
+                slot->version.store(version ? version : busy());
+                Version* now = current.load();
+                if (now == version)
+                {
+                    break;
+                }
+                version = now;
+            }
+            return Guard(slot, version ? version->get() : nullptr);
+        }
+
+        // Makes the filter current, the handle owns it. Returns once the previous version is deleted,
+        // which takes as long as the longest guard that holds it
+        void publish(OsirisFilter* filter)
+        {
+            replace(filter ? new Version{ filter, nullptr } : nullptr);
+        }
+
+        // a filter mapped from a file, which stays mapped while a guard holds it
+        void publish(OsirisFilterView* view)
+        {
+            replace(view ? new Version{ nullptr, view } : nullptr);
+        }
+
+        // queries of a handle without a filter may hold any key
+        bool pointQuery(const std::string& key) const
+        {
+            Guard guard = read();
+            return !guard || guard->pointQuery(key);
+        }
+
+        bool prefixQuery(const std::string& prefix) const
+        {
+            Guard guard = read();
+            return !guard || guard->prefixQuery(prefix);
+        }
+
+        bool rangeQuery(const std::string& left, bool include_left, const std::string& right, bool include_right) const
+        {
+            Guard guard = read();
+            return !guard || guard->rangeQuery(left, include_left, right, include_right);
+        }
+    };
+}
+
+#endif
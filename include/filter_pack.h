@@ -0,0 +1,340 @@
+/*
+ * This file is part of OsirisFilter <https://github.com/aplyusnin/OsirisFilter>.
+ * Copyright (C) 2024 Artem Plyusnin.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OSIRIS_FILTER_PACK_H
+#define OSIRIS_FILTER_PACK_H
+
+#include "osiris.h"
+#include <algorithm>
+#include <atomic>
+
+// A pack keeps many serialized filters in one file: a header, an index of the filters sorted by id, then the streams
+// of the filters, each one starting at an offset divisible by OSIRIS_SECTION_ALIGNMENT
+#define OSIRIS_PACK_VERSION 1
+
+namespace osiris
+{
+    struct PackHeader
+    {
+        char magic[8] = {'O', 'S', 'I', 'R', 'I', 'S', 'P', 'K'};
+        uint32_t version = OSIRIS_PACK_VERSION;
+        // of the index
+        uint32_t index_crc = 0;
+        uint64_t count = 0;
+        uint64_t total_size = 0;
+        // of the bytes above
+        uint32_t header_crc = 0;
+        uint8_t reserved[28] = {0};
+    };
+
+    static_assert(sizeof(PackHeader) == OSIRIS_SECTION_ALIGNMENT);
+
+    struct PackEntry
+    {
+        uint64_t id = 0;
+        // of the stream of the filter, from the start of the pack
+        uint64_t offset = 0;
+        uint64_t size = 0;
+    };
+
+    // Collects the filters of a pack and writes it. Neither the filters nor the streams are copied,
+    // they must stay alive until write()
+    class FilterPackWriter
+    {
+        struct Item
+        {
+            uint64_t id;
+            const OsirisFilter* filter;
+            const uint8_t* stream;
+            uint64_t size;
+        };
+
+        std::vector<Item> items;
+    public:
+        void add(uint64_t id, const OsirisFilter* filter)
+        {
+            items.push_back({ id, filter, nullptr, filter->serializedSize() });
+        }
+
+        // a stream written by serialize(), or the contents of a file written by build() with a path
+        void add(uint64_t id, const uint8_t* stream, uint64_t size)
+        {
+            items.push_back({ id, nullptr, stream, size });
+        }
+
+        // writes the pack to the file at the path, false if two filters have the same id or writing fails
+        bool write(const std::string& path)
+        {
+#if defined(__unix__) || defined(__APPLE__)
+            static const uint8_t zeros[OSIRIS_SECTION_ALIGNMENT] = {0};
+
+            std::sort(items.begin(), items.end(), [](const Item& a, const Item& b) { return a.id < b.id; });
+            std::vector<PackEntry> index(items.size());
+            uint64_t offset = alignSection(sizeof(PackHeader) + items.size() * sizeof(PackEntry));
+            for (size_t i = 0; i < items.size(); ++i)
+            {
+                if (i > 0 && items[i].id == items[i - 1].id)
+                {
+                    return false;
+                }
+                index[i] = { items[i].id, offset, items[i].size };
+                offset = alignSection(offset + items[i].size);
+            }
+
+            PackHeader header;
+            header.count = items.size();
+            header.total_size = offset;
+            header.index_crc = crc32c((const uint8_t*)index.data(), index.size() * sizeof(PackEntry));
+            header.header_crc = crc32c((const uint8_t*)&header, offsetof(PackHeader, header_crc));
+
+            int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0)
+            {
+                return false;
+            }
+            // the pieces are written one after another, from the current offset of the file
+            uint64_t position = 0;
+            auto put = [&](const uint8_t* data, size_t size)
+            {
+                iovec piece = { const_cast<uint8_t*>(data), size };
+                position += size;
+                return writeFully(fd, &piece, 1);
+            };
+            bool written = put((const uint8_t*)&header, sizeof(header)) &&
+                           put((const uint8_t*)index.data(), index.size() * sizeof(PackEntry));
+            for (size_t i = 0; written && i < items.size(); ++i)
+            {
+                written = put(zeros, index[i].offset - position);
+                if (items[i].filter)
+                {
+                    written = written && items[i].filter->serializeTo(fd);
+                    position += items[i].size;
+                }
+                else
+                {
+                    written = written && put(items[i].stream, items[i].size);
+                }
+            }
+            written = written && put(zeros, header.total_size - position);
+            return ::close(fd) == 0 && written;
+#else
+            (void)path;
+            return false;
+#endif
+        }
+    };
+
+    // Read-only filters of a pack: the file is mapped once and every filter is a view over its part of the mapping,
+    // loaded the first time it is asked for. Any number of threads may query the pack at once.
+    // By default no section is copied: the filters of a pack tend to be small, so copying their small sections
+    // would copy them whole
+    class FilterPack
+    {
+        const uint8_t* base = nullptr;
+        uint64_t count = 0;
+        LoadOptions options;
+        std::unique_ptr<std::atomic<OsirisFilter*>[]> views;
+
+        void* mapping = nullptr;
+        size_t mapping_size = 0;
+
+        FilterPack() = default;
+
+        PackEntry entry(size_t index) const
+        {
+            PackEntry result;
+            memmove(&result, base + sizeof(PackHeader) + index * sizeof(PackEntry), sizeof(result));
+            return result;
+        }
+
+        // checks the header and the index of the pack in the buffer, false if they are damaged
+        bool attach(const uint8_t* buffer, size_t size)
+        {
+            PackHeader header;
+            if (size < sizeof(header))
+            {
+                return false;
+            }
+            memmove(&header, buffer, sizeof(header));
+            if (memcmp(header.magic, PackHeader().magic, sizeof(header.magic)) != 0 ||
+                header.version != OSIRIS_PACK_VERSION ||
+                header.header_crc != crc32c(buffer, offsetof(PackHeader, header_crc)) ||
+                header.total_size > size || header.total_size < sizeof(header) ||
+                header.count > (header.total_size - sizeof(header)) / sizeof(PackEntry) ||
+                header.index_crc != crc32c(buffer + sizeof(header), header.count * sizeof(PackEntry)))
+            {
+                return false;
+            }
+            base = buffer;
+            count = header.count;
+            for (size_t i = 0; i < count; ++i)
+            {
+                PackEntry current = entry(i);
+                if (current.offset > header.total_size || current.size > header.total_size - current.offset ||
+                    (i > 0 && entry(i - 1).id >= current.id))
+                {
+                    base = nullptr;
+                    count = 0;
+                    return false;
+                }
+            }
+            views.reset(new std::atomic<OsirisFilter*>[count]);
+            for (size_t i = 0; i < count; ++i)
+            {
+                views[i].store(nullptr, std::memory_order_relaxed);
+            }
+            return true;
+        }
+    public:
+        // a pack in a buffer the caller keeps alive and unchanged while the pack is used
+        FilterPack(const uint8_t* buffer, size_t size, const LoadOptions& options = LoadOptions{ false, 0 })
+            : options(options)
+        {
+            attach(buffer, size);
+        }
+
+        FilterPack(const FilterPack&) = delete;
+        FilterPack& operator=(const FilterPack&) = delete;
+
+        // maps the file written by FilterPackWriter, nullptr if it cannot be mapped or is damaged
+        static FilterPack* open(const std::string& path, const LoadOptions& options = LoadOptions{ false, 0 })
+        {
+#if defined(__unix__) || defined(__APPLE__)
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+            {
+                return nullptr;
+            }
+            struct stat info;
+            if (fstat(fd, &info) != 0 || info.st_size == 0)
+            {
+                ::close(fd);
+                return nullptr;
+            }
+            size_t size = info.st_size;
+            void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            // the mapping keeps the file alive
+            ::close(fd);
+            if (mapping == MAP_FAILED)
+            {
+                return nullptr;
+            }
+            auto* pack = new FilterPack();
+            pack->options = options;
+            pack->mapping = mapping;
+            pack->mapping_size = size;
+            if (!pack->attach((const uint8_t*)mapping, size))
+            {
+                delete pack;
+                return nullptr;
+            }
+            return pack;
+#else
+            (void)path;
+            (void)options;
+            return nullptr;
+#endif
+        }
+
+        ~FilterPack()
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                delete views[i].load(std::memory_order_relaxed);
+            }
+#if defined(__unix__) || defined(__APPLE__)
+            if (mapping)
+            {
+                munmap(mapping, mapping_size);
+            }
+#endif
+        }
+
+        // false if the buffer holds no pack
+        bool valid() const
+        {
+            return base != nullptr;
+        }
+
+        size_t size() const
+        {
+            return count;
+        }
+
+        // ids of the filters increase with the index
+        uint64_t id(size_t index) const
+        {
+            return entry(index).id;
+        }
+
+        // the bytes of the entry at the index, for entries that hold data other than a filter
+        std::span<const uint8_t> stream(size_t index) const
+        {
+            PackEntry current = entry(index);
+            return { base + current.offset, current.size };
+        }
+
+        // the filter at the index, nullptr if its stream is damaged
+        const OsirisFilter* at(size_t index) const
+        {
+            OsirisFilter* view = views[index].load(std::memory_order_acquire);
+            if (view)
+            {
+                return view;
+            }
+            PackEntry current = entry(index);
+            OsirisFilter* loaded = deserializeView(base + current.offset, current.size, options);
+            if (!loaded)
+            {
+                return nullptr;
+            }
+            // a thread that loaded it first wins, the others drop their copies
+            if (!views[index].compare_exchange_strong(view, loaded, std::memory_order_acq_rel))
+            {
+                delete loaded;
+                return view;
+            }
+            return loaded;
+        }
+
+        // the filter with the id, nullptr if the pack has none or its stream is damaged
+        const OsirisFilter* find(uint64_t id) const
+        {
+            size_t left = 0, right = count;
+            while (left < right)
+            {
+                size_t middle = left + (right - left) / 2;
+                if (entry(middle).id < id)
+                {
+                    left = middle + 1;
+                }
+                else
+                {
+                    right = middle;
+                }
+            }
+            if (left == count || entry(left).id != id)
+            {
+                return nullptr;
+            }
+            return at(left);
+        }
+    };
+}
+
+#endif
@@ -21,6 +21,11 @@
 
 #include "osiris_filter.h"
 
+// number of queries advanced together by the lockstep batch of short fixed-length keys
+#ifndef OSIRIS_LOCKSTEP_WIDTH
+#define OSIRIS_LOCKSTEP_WIDTH 8
+#endif
+
 namespace osiris
 {
 	class FixedLengthFilter : public OsirisFilter
@@ -50,16 +55,20 @@ namespace osiris
                 data.link_lengths[i].reserve(cnt + 5);
             }
 
-            bool built = false;
+            bool built = true;
 
             data.id = 0;
             hash_seed = osiris_rng();
+            data.hasher = nodeHasher();
 
             collectDataAndHashes(data, keys, 0ull, keys.size() - 1, 0ull, hash_seed, hash_seed);
 
             max_link_size_in_bits = data.max_link_length;
 
-            size_t length_bits = getSize(data.max_link_length);
+            // parts of the links kept apart from length[bit] and links[bit] in the optional layouts
+            LinkStorage link_storage;
+            size_t length_bits = prepareLinkStorage(data.link_lengths, data.link_chunks, 2, 0, data.max_link_length, link_storage);
+            built &= buildLinkStorage(hashes, link_storage);
 
             for (int i = 0; i < 2; ++i)
             {
@@ -69,11 +78,11 @@ namespace osiris
                     {
                         links_mask[i] |= (1ull << j);
 
-                        links[i][j] = initDictionary(data.link_chunks[i][j].size(), 1ull << j);
+                        links[i][j] = newDictionary(data.link_chunks[i][j].size(), 1ull << j);
                         built &= links[i][j]->build(hashes, data.link_chunks[i][j]);
                     }
                 }
-                length[i] = initDictionary(data.link_lengths[i].size(), length_bits);
+                length[i] = newDictionary(data.link_lengths[i].size(), length_bits);
                 built &= length[i]->build(hashes, data.link_lengths[i]);
             }
             size_t retries = 0;
@@ -81,9 +90,11 @@ namespace osiris
             {
                 retries++;
                 hash_seed = osiris_rng();
+                data.hasher = nodeHasher();
                 data.id = 0;
                 collectHashes(data, keys, 0ull, keys.size() - 1, 0ull, hash_seed, hash_seed);
                 built = true;
+                built &= buildLinkStorage(hashes, link_storage);
                 for (int i = 0; i < 2; ++i)
                 {
                     for (int j = 0; j < 32; ++j)
@@ -100,11 +111,8 @@ namespace osiris
             FAIL:;
             }
 
-            hash_cache[0] = nextRand(hash_seed);
-            for (int i = 1; i < OSIRIS_HASH_CACHE_SIZE; ++i)
-            {
-                hash_cache[i] = nextRand(hash_cache[i - 1]);
-            }
+            max_depth = data.max_depth;
+            initSeedCache(max_depth);
             bitstring::clear();
             delete[] hashes;
             return retries;
@@ -115,7 +123,7 @@ namespace osiris
         /// Queries ///
         //////////////
 
-		bool pointQueryInternal(const std::string& key, uint8_t* link_buffer) override
+		bool pointQueryInternal(const std::string& key, uint8_t* link_buffer) const override
 		{
 			// if key has wrong size ---> it does not belong to the set
 			if (key.size() != key_length) return false;
@@ -141,6 +149,12 @@ namespace osiris
 			uint8_t m0 = 128;
 			uint8_t m1 = 0;
 
+			// the top levels are resolved by a single lookup
+			if (!skipTopLevels(key, pos, m0, cur, s, hash_id))
+			{
+				return false;
+			}
+
 			uint8_t val = key[pos];
 			uint8_t val1 = 0;
 			uint8_t bit1;
@@ -179,8 +193,15 @@ namespace osiris
 					NEXT_BIT_IN_LOOP(key, pos, val, m0, key_len)
 						continue;
 				}
+				PREFETCH_CHILDREN(cur, s, hash_id);
+
 				// restoring next link in the set
 				link_len = extractLink(bit, cur, link_buffer);
+				// a broken link ---> no key is below the node
+				if (link_len == OSIRIS_BROKEN_LINK)
+				{
+					return false;
+				}
 				// updating hash to point to the next trie's node
 				UPDATE_HASH(cur, s, bit, hash_id, h1, h2)
 
@@ -191,7 +212,7 @@ namespace osiris
 			return true;
 		}
 
-		bool prefixQueryInternal(const std::string& key, uint8_t* link_buffer) override
+		bool prefixQueryInternal(const std::string& key, uint8_t* link_buffer) const override
 		{
 			// get the first bit of the key
 			uint8_t bit = (key[0] >> 7) & 1;
@@ -214,6 +235,12 @@ namespace osiris
 			uint8_t m0 = 128;
 			uint8_t m1 = 0;
 
+			// the top levels are resolved by a single lookup
+			if (!skipTopLevels(key, pos, m0, cur, s, hash_id))
+			{
+				return false;
+			}
+
 			uint8_t val = key[pos];
 			uint8_t val1 = 0;
 			uint8_t bit1;
@@ -252,8 +279,15 @@ namespace osiris
 					NEXT_BIT_IN_LOOP(key, pos, val, m0, key_len)
 						continue;
 				}
+				PREFETCH_CHILDREN(cur, s, hash_id);
+
 				// restoring next link in the set
 				link_len = extractLink(bit, cur, link_buffer);
+				// a broken link ---> no key is below the node
+				if (link_len == OSIRIS_BROKEN_LINK)
+				{
+					return false;
+				}
 				// updating hash to point to the next trie's node
 				UPDATE_HASH(cur, s, bit, hash_id, h1, h2)
 
@@ -267,7 +301,7 @@ namespace osiris
         bool rangeQueryInternal(
             const std::string& left, bool include_left,
             const std::string& right, bool include_right,
-            uint8_t* prefix_buffer, uint8_t* tail_buffer)
+            uint8_t* prefix_buffer, uint8_t* tail_buffer) const
         {
             uint32_t left_key_size = (uint32_t)left.size();
             uint32_t right_key_size = (uint32_t)right.size();
@@ -373,8 +407,15 @@ namespace osiris
                     return false;
                 }
 
+                PREFETCH_CHILDREN(cur, s, hash_id);
+
                 // otherwise update link
                 link_len = extractLink(left_bit, cur, prefix_buffer);
+                // a broken link ---> no key is below the node
+                if (link_len == OSIRIS_BROKEN_LINK)
+                {
+                    return false;
+                }
                 pt = 0;
 
                 // go to the next vertex
@@ -412,7 +453,7 @@ namespace osiris
             size_t pos, uint8_t m0,
             hash_t cur, hash_t current_seed, int hash_id,
             bool include_tail, bool is_left,
-            bool can_pick, uint8_t* tail_buffer) {
+            bool can_pick, uint8_t* tail_buffer) const {
 
             // We cannot traverse further than the key_size
             uint32_t key_len = std::min((uint32_t)key.size(), key_length);
@@ -495,8 +536,15 @@ namespace osiris
                 if (can_pick && is_left != bit)
                     return true;
 
+                PREFETCH_CHILDREN(cur, current_seed, hash_id);
+
                 // restoring next link
                 link_len = extractLink(bit, cur, tail_buffer);
+                // a broken link ---> no key is below the node
+                if (link_len == OSIRIS_BROKEN_LINK)
+                {
+                    return false;
+                }
                 // moving to the next node
                 UPDATE_HASH(cur, current_seed, bit, hash_id, h1, h2)
 
@@ -519,7 +567,7 @@ namespace osiris
             size_t pos1, uint8_t m1, size_t len,
             hash_t cur, hash_t s, int hash_id,
             uint8_t* prefix_buffer, uint8_t* tail_buffer,
-            bool include_left)
+            bool include_left) const
         {
             uint32_t key_len = std::min((uint32_t)left.size(), key_length);
 
@@ -556,7 +604,7 @@ namespace osiris
             size_t pos1, uint8_t m1, size_t len,
             hash_t cur, hash_t s, int hashId,
             uint8_t* prefix_buffer, uint8_t* tail_buffer,
-            bool include_right)
+            bool include_right) const
         {
             uint32_t key_len = std::min((uint32_t)right.size(), key_length);
 
@@ -587,16 +635,141 @@ namespace osiris
             else return  rangeQueryTail(right, pos, m0, cur, s, hashId, include_right, false, true, tail_buffer);
         }
 
+        //////////////////////////
+        /// Batched traversal ///
+        /////////////////////////
+
+        bool admitBatchQuery(std::string_view key, bool is_point) const override
+        {
+            // all keys have the same size, so longer prefixes cannot occur
+            if (is_point ? key.size() != key_length : key.size() > key_length) return false;
+            return (root_mask >> (((uint8_t)key[0]) >> 7)) & 1;
+        }
+
+        // reads 64 bits of a key stored in lsb-first order, starting from the given bit
+        static uint64_t keyBits(const uint64_t* key, size_t from)
+        {
+            size_t shift = from & 63;
+            uint64_t value = key[from >> 6] >> shift;
+            if (shift)
+            {
+                value |= key[(from >> 6) + 1] << (64 - shift);
+            }
+            return value;
+        }
+
+        // Answers a group of up to OSIRIS_LOCKSTEP_WIDTH point queries of at most 16 bytes together.
+        // Every lane visits exactly one node per step, so all of them are at the same depth and share
+        // the hash sequence, while the probes of all lanes are issued before any of them is read.
+        // Links are compared with the key word by word instead of bit by bit.
+        void pointQueryLockstep(std::span<const std::string> keys, size_t first, uint8_t* result) const
+        {
+            constexpr size_t width = OSIRIS_LOCKSTEP_WIDTH;
+            size_t count = std::min(width, keys.size() - first);
+            size_t total_bits = (size_t)key_length << 3;
+
+            // keys in lsb-first bit order padded with a zero word, so 64 bits can be read from any position
+            uint64_t key_bits[width][3];
+            uint8_t link_buffer[width][24];
+            location_t length_loc[width];
+            location_t chunks[width][32];
+            hash_t cur[width];
+            size_t pos[width];
+            size_t size[width];
+            bool bit[width];
+            bool alive[width];
+            size_t remaining = 0;
+
+            for (size_t lane = 0; lane < width; ++lane)
+            {
+                alive[lane] = false;
+                if (lane >= count) continue;
+
+                const std::string& key = keys[first + lane];
+                setResultBit(result, first + lane, false);
+                if (key.size() != key_length || !((root_mask >> (((uint8_t)key[0]) >> 7)) & 1) || !prefilterAdmits(key))
+                {
+                    continue;
+                }
+
+                key_bits[lane][0] = key_bits[lane][1] = key_bits[lane][2] = 0;
+                for (size_t j = 0; j < key_length; ++j)
+                {
+                    key_bits[lane][j >> 3] |= (uint64_t)rev_bit[(uint8_t)key[j]] << ((j & 7) << 3);
+                }
+                cur[lane] = hash_seed;
+                pos[lane] = 0;
+                alive[lane] = true;
+                remaining++;
+            }
+
+            hash_t s = hash_seed;
+            int hash_id = 0;
+            hash_t h1, h2;
+            while (remaining)
+            {
+                for (size_t lane = 0; lane < width; ++lane)
+                {
+                    if (!alive[lane]) continue;
+                    bit[lane] = (key_bits[lane][pos[lane] >> 6] >> (pos[lane] & 63)) & 1;
+                    length_loc[lane] = length[bit[lane]]->locate(cur[lane]);
+                    length[bit[lane]]->prefetch(length_loc[lane]);
+                }
+
+                for (size_t lane = 0; lane < width; ++lane)
+                {
+                    if (!alive[lane]) continue;
+                    size[lane] = readLinkLength(bit[lane], cur[lane], length_loc[lane]);
+                    locateLink(bit[lane], cur[lane], size[lane], chunks[lane]);
+                }
+
+                for (size_t lane = 0; lane < width; ++lane)
+                {
+                    if (!alive[lane]) continue;
+                    // the branching bit is not a part of the link
+                    size_t from = pos[lane] + 1;
+                    bool matches = gatherLink(bit[lane], size[lane], chunks[lane], link_buffer[lane]) &&
+                                   from + size[lane] <= total_bits;
+                    for (size_t done = 0; matches && done < size[lane]; done += 64)
+                    {
+                        size_t n = std::min((size_t)64, size[lane] - done);
+                        uint64_t link;
+                        memcpy(&link, link_buffer[lane] + (done >> 3), sizeof(link));
+                        uint64_t mask = n == 64 ? ~0ull : (1ull << n) - 1;
+                        matches = !((link ^ keyBits(key_bits[lane], from + done)) & mask);
+                    }
+
+                    pos[lane] = from + size[lane];
+                    if (!matches || pos[lane] == total_bits)
+                    {
+                        // the key either left the trie or reached its leaf
+                        setResultBit(result, first + lane, matches);
+                        alive[lane] = false;
+                        remaining--;
+                    }
+                }
+
+                // all lanes are at the same depth, so the hash sequence is shared
+                childSeeds(s, hash_id++, h1, h2);
+                s = h2;
+                for (size_t lane = 0; lane < width; ++lane)
+                {
+                    if (!alive[lane]) continue;
+                    cur[lane] ^= bit[lane] ? h2 : h1;
+                }
+            }
+        }
+
 		//////////////////////
 		/// Serialization ///
 		/////////////////////
 
-        uint8_t getFilterId() override
+        uint8_t getFilterId() const override
         {
             return 1;
         }
 
-        uint8_t* serializeExtra(uint8_t* buf) override
+        uint8_t* serializeExtra(uint8_t* buf, SectionSink&) const override
         {
             memmove(buf, &root_mask, sizeof(root_mask));
             buf += sizeof(root_mask);
@@ -604,14 +777,29 @@ namespace osiris
             return buf + sizeof(key_length);
         }
 
-        size_t serializeExtraSize() override
+        size_t serializeExtraSize() const override
         {
             return sizeof(key_length) + sizeof(root_mask);
         }
 
 	public:
 
-		FixedLengthFilter(const std::vector<std::string>& keys, KeySetInfo info)
+        void pointQueryBatch(std::span<const std::string> keys, uint8_t* result) const override
+        {
+            // a whole short key fits into a couple of machine words,
+            // the lanes must start at the root though, which the top levels would break
+            if (key_length > 16 || top_bits)
+            {
+                OsirisFilter::pointQueryBatch(keys, result);
+                return;
+            }
+            for (size_t first = 0; first < keys.size(); first += OSIRIS_LOCKSTEP_WIDTH)
+            {
+                pointQueryLockstep(keys, first, result);
+            }
+        }
+
+		FixedLengthFilter(const std::vector<std::string>& keys, KeySetInfo info, const BuildOptions& options = BuildOptions())
 		{
             key_length = info.max_size;
 
@@ -619,14 +807,17 @@ namespace osiris
             root_mask |= (1 << (((uint8_t)keys[0][0]) >> 7));
             root_mask |= (1 << (((uint8_t)keys.back()[0]) >> 7));
 
-            auto retries = construct(keys, info);
-            OSIRIS_DEBUG_PRINT("retries: ", retries);
+            selectLayout(options);
+            build_retries = construct(keys, info);
+            OSIRIS_DEBUG_PRINT("retries: ", build_retries);
+            buildTopLevels(keys, options.top_level_bits);
+            buildPrefilter(keys, options.point_prefilter);
 		}
 
         // deserializing constructor 
-		FixedLengthFilter(uint8_t* buf)
+		FixedLengthFilter(uint8_t* buf, const FilterHeader& header = FilterHeader())
 		{
-           buf = deserializeCore(buf);
+           buf = deserializeCore(buf, header);
 
             memmove(&root_mask, buf, sizeof(root_mask));
             buf += sizeof(root_mask);
@@ -22,6 +22,8 @@
 #include "bitstring.h"
 #include "utils.h"
 
+#include <string_view>
+
 #define EXTRACT_BIT(word, pos) (((word)[(pos) >> 3] & (1 << (7 ^ ((pos) & 7)))))
 
 namespace osiris
@@ -63,6 +65,9 @@ namespace osiris
     {
         size_t id;
         size_t max_link_length = 0;
+        // number of nodes on the longest root-to-leaf path
+        size_t max_depth = 0;
+        NodeHasher hasher;
         std::vector<std::pair<size_t, size_t>> link_lengths[2];
         std::vector<std::pair<size_t, bitstring>> link_chunks[2][32];
         hash_t* hashes;
@@ -72,17 +77,16 @@ namespace osiris
 
     inline void collectDataAndHashes(FixedKeySetData& key_set_data, const std::vector<std::string>& keys,
                               size_t l, size_t r, size_t pos,
-                              hash_t cur_hash, hash_t seed)
+                              hash_t cur_hash, hash_t seed, size_t depth = 0)
     {
         size_t id = key_set_data.id++;
+        key_set_data.max_depth = std::max(key_set_data.max_depth, depth + 1);
 
         key_set_data.hashes[id] = cur_hash;
 
-        hash_t seeds[3];
-        seeds[0] = nextRand(seed);
-        seeds[1] = nextRand(seeds[0]);
-        seeds[2] = nextRand(seeds[1]);
-        hash_t child_hash[2] = {cur_hash ^ seeds[1], cur_hash ^ seeds[2] };
+        hash_t seeds[2];
+        key_set_data.hasher.childSeeds(seed, depth, seeds[0], seeds[1]);
+        hash_t child_hash[2] = {cur_hash ^ seeds[0], cur_hash ^ seeds[1] };
 
         size_t l1 = l;
 
@@ -107,7 +111,7 @@ namespace osiris
             key_set_data.max_link_length = std::max(key_set_data.max_link_length, link_length);
             key_set_data.link_lengths[bit].emplace_back(id, link_length);
             consumeLink(key_set_data.link_chunks[bit], keys[l], pos + 1, link_length, id);
-            collectDataAndHashes(key_set_data, keys, l + 1, r, length, child_hash[bit], seeds[2]);
+            collectDataAndHashes(key_set_data, keys, l + 1, r, length, child_hash[bit], seeds[1], depth + 1);
             return;
         }
 
@@ -124,7 +128,7 @@ namespace osiris
             key_set_data.link_lengths[bit].emplace_back(id, link_length);
 
             consumeLink(key_set_data.link_chunks[bit], keys[l], pos + 1, link_length, id);
-            collectDataAndHashes(key_set_data, keys, l, r, next_pos, child_hash[bit], seeds[2]);
+            collectDataAndHashes(key_set_data, keys, l, r, next_pos, child_hash[bit], seeds[1], depth + 1);
             return;
         }
 
@@ -138,7 +142,7 @@ namespace osiris
             key_set_data.link_lengths[0].emplace_back(id, link_length);
 
             consumeLink(key_set_data.link_chunks[0], keys[l], pos + 1, link_length, id);
-            collectDataAndHashes(key_set_data, keys, l, m, next_pos, child_hash[0], seeds[2]);
+            collectDataAndHashes(key_set_data, keys, l, m, next_pos, child_hash[0], seeds[1], depth + 1);
         }
         {
             auto next_pos = findCommonPrefix(keys[m + 1], keys[r], pos);
@@ -148,23 +152,21 @@ namespace osiris
             key_set_data.link_lengths[1].emplace_back(id, link_length);
 
             consumeLink(key_set_data.link_chunks[1], keys[m + 1], pos + 1, link_length, id);
-            collectDataAndHashes(key_set_data, keys, m + 1, r, next_pos, child_hash[1], seeds[2]);
+            collectDataAndHashes(key_set_data, keys, m + 1, r, next_pos, child_hash[1], seeds[1], depth + 1);
         }
     }
 
     inline void collectHashes(FixedKeySetData& key_set_data, const std::vector<std::string>& keys,
                                      size_t l, size_t r, size_t pos,
-                                     hash_t cur_hash, hash_t seed)
+                                     hash_t cur_hash, hash_t seed, size_t depth = 0)
     {
         size_t id = key_set_data.id++;
 
         key_set_data.hashes[id] = cur_hash;
 
-        hash_t seeds[3];
-        seeds[0] = nextRand(seed);
-        seeds[1] = nextRand(seeds[0]);
-        seeds[2] = nextRand(seeds[1]);
-        hash_t child_hash[2] = {cur_hash ^ seeds[1], cur_hash ^ seeds[2] };
+        hash_t seeds[2];
+        key_set_data.hasher.childSeeds(seed, depth, seeds[0], seeds[1]);
+        hash_t child_hash[2] = {cur_hash ^ seeds[0], cur_hash ^ seeds[1] };
 
         size_t l1 = l;
 
@@ -183,7 +185,7 @@ namespace osiris
             size_t bit_id = pos & 7;
             size_t byte_id = pos >> 3;
             bool bit = (rev_bit[keys[l][byte_id]] >> bit_id) & 1;
-            collectHashes(key_set_data, keys, l + 1, r, length, child_hash[bit], seeds[2]);
+            collectHashes(key_set_data, keys, l + 1, r, length, child_hash[bit], seeds[1], depth + 1);
             return;
         }
 
@@ -194,7 +196,7 @@ namespace osiris
             size_t byte_id = pos >> 3;
             bool bit = (rev_bit[keys[l][byte_id]] >> bit_id) & 1;
 
-            collectHashes(key_set_data, keys, l, r, next_pos, child_hash[bit], seeds[2]);
+            collectHashes(key_set_data, keys, l, r, next_pos, child_hash[bit], seeds[1], depth + 1);
             return;
         }
 
@@ -202,11 +204,11 @@ namespace osiris
 
         {
             auto next_pos = findCommonPrefix(keys[l], keys[m], pos);
-            collectHashes(key_set_data, keys, l, m, next_pos, child_hash[0], seeds[2]);
+            collectHashes(key_set_data, keys, l, m, next_pos, child_hash[0], seeds[1], depth + 1);
         }
         {
             auto next_pos = findCommonPrefix(keys[m + 1], keys[r], pos);
-            collectHashes(key_set_data, keys, m + 1, r, next_pos, child_hash[1], seeds[2]);
+            collectHashes(key_set_data, keys, m + 1, r, next_pos, child_hash[1], seeds[1], depth + 1);
         }
     }
 
@@ -214,6 +216,9 @@ namespace osiris
     {
         size_t id;
         size_t max_link_length = 0;
+        // number of nodes on the longest root-to-leaf path
+        size_t max_depth = 0;
+        NodeHasher hasher;
         std::vector<std::pair<size_t, size_t>> link_lengths[2];
         std::vector<std::pair<size_t, bitstring>> link_chunks[2][32];
         std::vector<std::pair<size_t, bitstring>> is_leaf;
@@ -222,17 +227,16 @@ namespace osiris
 
     inline void collectDataAndHashes(NoPrefixKeySetData& key_set_data, const std::vector<std::string>& keys,
                                      size_t l, size_t r, size_t pos,
-                                     hash_t cur_hash, hash_t seed)
+                                     hash_t cur_hash, hash_t seed, size_t depth = 0)
     {
         size_t id = key_set_data.id++;
+        key_set_data.max_depth = std::max(key_set_data.max_depth, depth + 1);
 
         key_set_data.hashes[id] = cur_hash;
 
-        hash_t seeds[3];
-        seeds[0] = nextRand(seed);
-        seeds[1] = nextRand(seeds[0]);
-        seeds[2] = nextRand(seeds[1]);
-        hash_t child_hash[2] = {cur_hash ^ seeds[1], cur_hash ^ seeds[2] };
+        hash_t seeds[2];
+        key_set_data.hasher.childSeeds(seed, depth, seeds[0], seeds[1]);
+        hash_t child_hash[2] = {cur_hash ^ seeds[0], cur_hash ^ seeds[1] };
 
         size_t l1 = l;
 
@@ -265,7 +269,7 @@ namespace osiris
             key_set_data.max_link_length = std::max(key_set_data.max_link_length, link_length);
             key_set_data.link_lengths[bit].emplace_back(id, link_length);
             consumeLink(key_set_data.link_chunks[bit], keys[l], pos + 1, link_length, id);
-            collectDataAndHashes(key_set_data, keys, l + 1, r, length, child_hash[bit], seeds[2]);
+            collectDataAndHashes(key_set_data, keys, l + 1, r, length, child_hash[bit], seeds[1], depth + 1);
             return;
         }
 
@@ -282,7 +286,7 @@ namespace osiris
             key_set_data.link_lengths[bit].emplace_back(id, link_length);
 
             consumeLink(key_set_data.link_chunks[bit], keys[l], pos + 1, link_length, id);
-            collectDataAndHashes(key_set_data, keys, l, r, next_pos, child_hash[bit], seeds[2]);
+            collectDataAndHashes(key_set_data, keys, l, r, next_pos, child_hash[bit], seeds[1], depth + 1);
             return;
         }
 
@@ -296,7 +300,7 @@ namespace osiris
             key_set_data.link_lengths[0].emplace_back(id, link_length);
 
             consumeLink(key_set_data.link_chunks[0], keys[l], pos + 1, link_length, id);
-            collectDataAndHashes(key_set_data, keys, l, m, next_pos, child_hash[0], seeds[2]);
+            collectDataAndHashes(key_set_data, keys, l, m, next_pos, child_hash[0], seeds[1], depth + 1);
         }
         {
             auto next_pos = findCommonPrefix(keys[m + 1], keys[r], pos);
@@ -306,23 +310,21 @@ namespace osiris
             key_set_data.link_lengths[1].emplace_back(id, link_length);
 
             consumeLink(key_set_data.link_chunks[1], keys[m + 1], pos + 1, link_length, id);
-            collectDataAndHashes(key_set_data, keys, m + 1, r, next_pos, child_hash[1], seeds[2]);
+            collectDataAndHashes(key_set_data, keys, m + 1, r, next_pos, child_hash[1], seeds[1], depth + 1);
         }
     }
 
     inline void collectHashes(NoPrefixKeySetData& key_set_data, const std::vector<std::string>& keys,
                               size_t l, size_t r, size_t pos,
-                              hash_t cur_hash, hash_t seed)
+                              hash_t cur_hash, hash_t seed, size_t depth = 0)
     {
         size_t id = key_set_data.id++;
 
         key_set_data.hashes[id] = cur_hash;
 
-        hash_t seeds[3];
-        seeds[0] = nextRand(seed);
-        seeds[1] = nextRand(seeds[0]);
-        seeds[2] = nextRand(seeds[1]);
-        hash_t child_hash[2] = {cur_hash ^ seeds[1], cur_hash ^ seeds[2] };
+        hash_t seeds[2];
+        key_set_data.hasher.childSeeds(seed, depth, seeds[0], seeds[1]);
+        hash_t child_hash[2] = {cur_hash ^ seeds[0], cur_hash ^ seeds[1] };
 
         size_t l1 = l;
 
@@ -341,7 +343,7 @@ namespace osiris
             size_t bit_id = pos & 7;
             size_t byte_id = pos >> 3;
             bool bit = (rev_bit[keys[l][byte_id]] >> bit_id) & 1;
-            collectHashes(key_set_data, keys, l + 1, r, length, child_hash[bit], seeds[2]);
+            collectHashes(key_set_data, keys, l + 1, r, length, child_hash[bit], seeds[1], depth + 1);
             return;
         }
 
@@ -352,7 +354,7 @@ namespace osiris
             size_t byte_id = pos >> 3;
             bool bit = (rev_bit[keys[l][byte_id]] >> bit_id) & 1;
 
-            collectHashes(key_set_data, keys, l, r, next_pos, child_hash[bit], seeds[2]);
+            collectHashes(key_set_data, keys, l, r, next_pos, child_hash[bit], seeds[1], depth + 1);
             return;
         }
 
@@ -360,11 +362,11 @@ namespace osiris
 
         {
             auto next_pos = findCommonPrefix(keys[l], keys[m], pos);
-            collectHashes(key_set_data, keys, l, m, next_pos, child_hash[0], seeds[2]);
+            collectHashes(key_set_data, keys, l, m, next_pos, child_hash[0], seeds[1], depth + 1);
         }
         {
             auto next_pos = findCommonPrefix(keys[m + 1], keys[r], pos);
-            collectHashes(key_set_data, keys, m + 1, r, next_pos, child_hash[1], seeds[2]);
+            collectHashes(key_set_data, keys, m + 1, r, next_pos, child_hash[1], seeds[1], depth + 1);
         }
     }
 
@@ -373,6 +375,9 @@ namespace osiris
     {
         size_t id = 0;
         size_t max_link_length = 0;
+        // number of nodes on the longest root-to-leaf path
+        size_t max_depth = 0;
+        NodeHasher hasher;
         std::vector<std::pair<size_t, size_t>> link_lengths[2];
         std::vector<std::pair<size_t, bitstring>> link_chunks[2][32];
         std::vector<std::pair<size_t, bitstring>> link_mask;
@@ -382,17 +387,16 @@ namespace osiris
 
     inline void collectDataAndHashes(CommonPrefixKeySetData& key_set_data, const std::vector<std::string>& keys,
                                      size_t l, size_t r, size_t pos,
-                                     hash_t cur_hash, hash_t seed)
+                                     hash_t cur_hash, hash_t seed, size_t depth = 0)
     {
         size_t id = key_set_data.id++;
+        key_set_data.max_depth = std::max(key_set_data.max_depth, depth + 1);
 
         key_set_data.hashes[id] = cur_hash;
 
-        hash_t seeds[3];
-        seeds[0] = nextRand(seed);
-        seeds[1] = nextRand(seeds[0]);
-        seeds[2] = nextRand(seeds[1]);
-        hash_t child_hash[2] = {cur_hash ^ seeds[1], cur_hash ^ seeds[2] };
+        hash_t seeds[2];
+        key_set_data.hasher.childSeeds(seed, depth, seeds[0], seeds[1]);
+        hash_t child_hash[2] = {cur_hash ^ seeds[0], cur_hash ^ seeds[1] };
 
         size_t l1 = l;
 
@@ -425,7 +429,7 @@ namespace osiris
             key_set_data.max_link_length = std::max(key_set_data.max_link_length, link_length);
             key_set_data.link_lengths[bit].emplace_back(id, link_length);
             consumeLink(key_set_data.link_chunks[bit], keys[l], pos + 1, link_length, id);
-            collectDataAndHashes(key_set_data, keys, l + 1, r, length, child_hash[bit], seeds[2]);
+            collectDataAndHashes(key_set_data, keys, l + 1, r, length, child_hash[bit], seeds[1], depth + 1);
             return;
         }
 
@@ -445,7 +449,7 @@ namespace osiris
             key_set_data.link_lengths[bit].emplace_back(id, link_length);
 
             consumeLink(key_set_data.link_chunks[bit], keys[l], pos + 1, link_length, id);
-            collectDataAndHashes(key_set_data, keys, l, r, next_pos, child_hash[bit], seeds[2]);
+            collectDataAndHashes(key_set_data, keys, l, r, next_pos, child_hash[bit], seeds[1], depth + 1);
             return;
         }
 
@@ -463,7 +467,7 @@ namespace osiris
             key_set_data.link_lengths[0].emplace_back(id, link_length);
 
             consumeLink(key_set_data.link_chunks[0], keys[l], pos + 1, link_length, id);
-            collectDataAndHashes(key_set_data, keys, l, m, next_pos, child_hash[0], seeds[2]);
+            collectDataAndHashes(key_set_data, keys, l, m, next_pos, child_hash[0], seeds[1], depth + 1);
         }
         {
             auto next_pos = findCommonPrefix(keys[m + 1], keys[r], pos);
@@ -473,23 +477,21 @@ namespace osiris
             key_set_data.link_lengths[1].emplace_back(id, link_length);
 
             consumeLink(key_set_data.link_chunks[1], keys[m + 1], pos + 1, link_length, id);
-            collectDataAndHashes(key_set_data, keys, m + 1, r, next_pos, child_hash[1], seeds[2]);
+            collectDataAndHashes(key_set_data, keys, m + 1, r, next_pos, child_hash[1], seeds[1], depth + 1);
         }
     }
 
     inline void collectHashes(CommonPrefixKeySetData& key_set_data, const std::vector<std::string>& keys,
                               size_t l, size_t r, size_t pos,
-                              hash_t cur_hash, hash_t seed)
+                              hash_t cur_hash, hash_t seed, size_t depth = 0)
     {
         size_t id = key_set_data.id++;
 
         key_set_data.hashes[id] = cur_hash;
 
-        hash_t seeds[3];
-        seeds[0] = nextRand(seed);
-        seeds[1] = nextRand(seeds[0]);
-        seeds[2] = nextRand(seeds[1]);
-        hash_t child_hash[2] = {cur_hash ^ seeds[1], cur_hash ^ seeds[2] };
+        hash_t seeds[2];
+        key_set_data.hasher.childSeeds(seed, depth, seeds[0], seeds[1]);
+        hash_t child_hash[2] = {cur_hash ^ seeds[0], cur_hash ^ seeds[1] };
 
         size_t l1 = l;
 
@@ -508,7 +510,7 @@ namespace osiris
             size_t bit_id = pos & 7;
             size_t byte_id = pos >> 3;
             bool bit = (rev_bit[keys[l][byte_id]] >> bit_id) & 1;
-            collectHashes(key_set_data, keys, l + 1, r, length, child_hash[bit], seeds[2]);
+            collectHashes(key_set_data, keys, l + 1, r, length, child_hash[bit], seeds[1], depth + 1);
             return;
         }
 
@@ -519,7 +521,7 @@ namespace osiris
             size_t byte_id = pos >> 3;
             bool bit = (rev_bit[keys[l][byte_id]] >> bit_id) & 1;
 
-            collectHashes(key_set_data, keys, l, r, next_pos, child_hash[bit], seeds[2]);
+            collectHashes(key_set_data, keys, l, r, next_pos, child_hash[bit], seeds[1], depth + 1);
             return;
         }
 
@@ -527,11 +529,103 @@ namespace osiris
 
         {
             auto next_pos = findCommonPrefix(keys[l], keys[m], pos);
-            collectHashes(key_set_data, keys, l, m, next_pos, child_hash[0], seeds[2]);
+            collectHashes(key_set_data, keys, l, m, next_pos, child_hash[0], seeds[1], depth + 1);
         }
         {
             auto next_pos = findCommonPrefix(keys[m + 1], keys[r], pos);
-            collectHashes(key_set_data, keys, m + 1, r, next_pos, child_hash[1], seeds[2]);
+            collectHashes(key_set_data, keys, m + 1, r, next_pos, child_hash[1], seeds[1], depth + 1);
+        }
+    }
+
+    // the digit of the given number of bits starting at the bit pos of the key, most significant bits first
+    inline size_t keyDigit(std::string_view key, size_t pos, size_t bits)
+    {
+        return ((uint8_t)key[pos >> 3] >> (8 - bits - (pos & 7))) & ((1u << bits) - 1);
+    }
+
+    struct RadixKeySetData
+    {
+        size_t id = 0;
+        size_t max_link_length = 0;
+        // number of nodes on the longest root-to-leaf path
+        size_t max_depth = 0;
+        NodeHasher hasher;
+        // number of bits a node branches on
+        size_t radix_bits = 4;
+        // links lead into the nodes, so they are stored by the hash of the node they end at
+        std::vector<std::pair<size_t, size_t>> link_lengths;
+        std::vector<std::pair<size_t, bitstring>> link_chunks[32];
+        // digits the children of every branching node start with
+        std::vector<std::pair<size_t, bitstring>> child_masks;
+        hash_t* hashes = nullptr;
+    };
+
+    // keys[l..r] share the first pos bits, the node stores the rest of their common prefix as its link
+    inline void collectDataAndHashes(RadixKeySetData& key_set_data, const std::vector<std::string>& keys,
+                                     size_t l, size_t r, size_t pos,
+                                     hash_t cur_hash, size_t depth = 0)
+    {
+        size_t id = key_set_data.id++;
+        key_set_data.max_depth = std::max(key_set_data.max_depth, depth + 1);
+
+        key_set_data.hashes[id] = cur_hash;
+
+        size_t radix_bits = key_set_data.radix_bits;
+        size_t total = keys[l].size() << 3;
+        size_t next_pos = l == r ? total : findCommonPrefix(keys[l], keys[r], pos);
+        // nodes branch on whole digits only
+        next_pos -= next_pos % radix_bits;
+
+        size_t link_length = next_pos - pos;
+        key_set_data.max_link_length = std::max(key_set_data.max_link_length, link_length);
+        key_set_data.link_lengths.emplace_back(id, link_length);
+        consumeLink(key_set_data.link_chunks, keys[l], pos, link_length, id);
+
+        if (next_pos == total) return;
+
+        size_t radix = 1ull << radix_bits;
+        size_t mask_id = key_set_data.child_masks.size();
+        key_set_data.child_masks.emplace_back(id, bitstring::select(radix));
+
+        // keys are sorted, so the keys of every child follow each other
+        for (size_t from = l; from <= r; )
+        {
+            size_t digit = keyDigit(keys[from], next_pos, radix_bits);
+            size_t to = from;
+            while (to < r && keyDigit(keys[to + 1], next_pos, radix_bits) == digit) to++;
+
+            key_set_data.child_masks[mask_id].second.set(digit, true);
+            collectDataAndHashes(key_set_data, keys, from, to, next_pos + radix_bits,
+                                 cur_hash ^ key_set_data.hasher.digitSeed(depth, digit, radix), depth + 1);
+            from = to + 1;
+        }
+    }
+
+    inline void collectHashes(RadixKeySetData& key_set_data, const std::vector<std::string>& keys,
+                              size_t l, size_t r, size_t pos,
+                              hash_t cur_hash, size_t depth = 0)
+    {
+        size_t id = key_set_data.id++;
+
+        key_set_data.hashes[id] = cur_hash;
+
+        size_t radix_bits = key_set_data.radix_bits;
+        size_t total = keys[l].size() << 3;
+        size_t next_pos = l == r ? total : findCommonPrefix(keys[l], keys[r], pos);
+        next_pos -= next_pos % radix_bits;
+
+        if (next_pos == total) return;
+
+        size_t radix = 1ull << radix_bits;
+        for (size_t from = l; from <= r; )
+        {
+            size_t digit = keyDigit(keys[from], next_pos, radix_bits);
+            size_t to = from;
+            while (to < r && keyDigit(keys[to + 1], next_pos, radix_bits) == digit) to++;
+
+            collectHashes(key_set_data, keys, from, to, next_pos + radix_bits,
+                          cur_hash ^ key_set_data.hasher.digitSeed(depth, digit, radix), depth + 1);
+            from = to + 1;
         }
     }
 
@@ -22,6 +22,10 @@
 #include <algorithm>
 #include <cstdint>
 #include <cmath>
+#include <string_view>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
 
 #include "utils.h"
 
@@ -38,6 +42,83 @@ namespace osiris
 		return value;
 	}
 
+	// splitmix64 finalizer
+	inline uint64_t mix64(uint64_t value)
+	{
+		value ^= value >> 30;
+		value *= 0xbf58476d1ce4e5b9ull;
+		value ^= value >> 27;
+		value *= 0x94d049bb133111ebull;
+		value ^= value >> 31;
+		return value;
+	}
+
+	// high 64 bits of the 128-bit product, maps a uniform value onto [0, b) without a division
+	inline uint64_t mulHigh(uint64_t a, uint64_t b)
+	{
+#if defined(_MSC_VER) && !defined(__clang__)
+		return __umulh(a, b);
+#else
+		return (uint64_t)(((__uint128_t)a * b) >> 64);
+#endif
+	}
+
+	// hash of a whole key, 8 bytes at a time
+	inline uint64_t hashKey(std::string_view key, uint64_t seed)
+	{
+		uint64_t hash = seed ^ (key.size() * 0x9e3779b97f4a7c15ull);
+		size_t i = 0;
+		for (; i + 8 <= key.size(); i += 8)
+		{
+			uint64_t word;
+			memcpy(&word, key.data() + i, 8);
+			hash = mix64(hash ^ word) + 0x9e3779b97f4a7c15ull;
+		}
+		if (i < key.size())
+		{
+			uint64_t word = 0;
+			memcpy(&word, key.data() + i, key.size() - i);
+			hash = mix64(hash ^ word) + 0x9e3779b97f4a7c15ull;
+		}
+		return mix64(hash);
+	}
+
+	enum HashScheme : uint8_t
+	{
+		// the seeds of a level are the next steps of the xorshift sequence started by the parent's seed,
+		// so reaching depth d takes 3d sequential steps
+		HASH_CHAIN,
+		// the seeds of a level are a function of the filter's seed and the depth only
+		HASH_COUNTER
+	};
+
+	// derives the seeds the children of a node combine with its hash: hash ^ h1 for bit 0, hash ^ h2 for bit 1
+	struct NodeHasher
+	{
+		hash_t seed = 0;
+		HashScheme scheme = HASH_CHAIN;
+
+		// parent is the seed passed down to the node, used only by the chain scheme
+		void childSeeds(hash_t parent, size_t depth, hash_t& h1, hash_t& h2) const
+		{
+			if (scheme == HASH_COUNTER)
+			{
+				h1 = mix64(seed + (2 * depth + 1) * 0x9e3779b97f4a7c15ull);
+				h2 = mix64(seed + (2 * depth + 2) * 0x9e3779b97f4a7c15ull);
+				return;
+			}
+			h1 = nextRand(nextRand(parent));
+			h2 = nextRand(h1);
+		}
+
+		// seed of the child a digit leads to, for tries branching on a radix of values at once;
+		// the counter scheme is the case radix = 2
+		hash_t digitSeed(size_t depth, size_t digit, size_t radix) const
+		{
+			return mix64(seed + (depth * radix + digit + 1) * 0x9e3779b97f4a7c15ull);
+		}
+	};
+
 	inline size_t calculateSegmentLengthLog(size_t size)
 	{
 		if (size == 1) return 1;
@@ -45,16 +45,20 @@ namespace osiris
                 data.link_lengths[i].reserve(cnt + 5);
             }
 
-            bool built = false;
+            bool built = true;
 
             data.id = 0;
             hash_seed = osiris_rng();
+            data.hasher = nodeHasher();
 
             collectDataAndHashes(data, keys, 0ull, keys.size() - 1, 0ull, hash_seed, hash_seed);
 
             max_link_size_in_bits = data.max_link_length;
 
-            size_t length_bits = getSize(data.max_link_length);
+            // parts of the links kept apart from length[bit] and links[bit] in the optional layouts
+            LinkStorage link_storage;
+            size_t length_bits = prepareLinkStorage(data.link_lengths, data.link_chunks, 2, 0, data.max_link_length, link_storage);
+            built &= buildLinkStorage(hashes, link_storage);
 
             for (int i = 0; i < 2; ++i)
             {
@@ -64,15 +68,15 @@ namespace osiris
                     {
                         links_mask[i] |= (1ull << j);
 
-                        links[i][j] = initDictionary(data.link_chunks[i][j].size(), 1ull << j);
+                        links[i][j] = newDictionary(data.link_chunks[i][j].size(), 1ull << j);
                         built &= links[i][j]->build(hashes, data.link_chunks[i][j]);
                     }
                 }
-                length[i] = initDictionary(data.link_lengths[i].size(), length_bits);
+                length[i] = newDictionary(data.link_lengths[i].size(), length_bits);
                 built &= length[i]->build(hashes, data.link_lengths[i]);
             }
 
-            leaf_masks = initDictionary(data.is_leaf.size(), 1);
+            leaf_masks = newDictionary(data.is_leaf.size(), 1);
             built &= leaf_masks->build(hashes, data.is_leaf);
 
             size_t retries = 0;
@@ -81,9 +85,11 @@ namespace osiris
             {
                 retries++;
                 hash_seed = osiris_rng();
+                data.hasher = nodeHasher();
                 data.id = 0;
                 collectHashes(data, keys, 0ull, keys.size() - 1, 0ull, hash_seed, hash_seed);
                 built = true;
+                built &= buildLinkStorage(hashes, link_storage);
                 for (int i = 0; i < 2; ++i)
                 {
                     for (int j = 0; j < 32; ++j)
@@ -99,18 +105,15 @@ namespace osiris
                 built &= leaf_masks->build(hashes, data.is_leaf);
             }
 
-            hash_cache[0] = nextRand(hash_seed);
-            for (int i = 1; i < OSIRIS_HASH_CACHE_SIZE; ++i)
-            {
-                hash_cache[i] = nextRand(hash_cache[i - 1]);
-            }
+            max_depth = data.max_depth;
+            initSeedCache(max_depth);
             bitstring::clear();
             delete[] hashes;
             return retries;
         }
 
 
-        bool pointQueryInternal(const std::string& key, uint8_t* link_buffer) override
+        bool pointQueryInternal(const std::string& key, uint8_t* link_buffer) const override
 		{
 			uint8_t current_mask = 0;
 
@@ -135,6 +138,12 @@ namespace osiris
 			uint8_t m0 = 128;
 			uint8_t m1 = 0;
 
+			// the top levels are resolved by a single lookup
+			if (!skipTopLevels(key, pos, m0, cur, s, hash_id))
+			{
+				return false;
+			}
+
 			uint8_t val = key[pos];
 			uint8_t val1 = 0;
 			uint8_t bit1;
@@ -175,6 +184,8 @@ namespace osiris
 					continue;
 				}
 
+				PREFETCH_CHILDREN(cur, s, hash_id);
+
 				// check the state of the node
 				this->leaf_masks->get(cur, &current_mask);
 
@@ -186,6 +197,11 @@ namespace osiris
 
 				// restoring next link in the set
 				link_len = extractLink(bit, cur, link_buffer);
+				// a broken link ---> no key is below the node
+				if (link_len == OSIRIS_BROKEN_LINK)
+				{
+					return false;
+				}
 				// updating hash to point to the next trie's node
 				UPDATE_HASH(cur, s, bit, hash_id, h1, h2)
 				
@@ -205,7 +221,7 @@ namespace osiris
 			return current_mask == 0;
 		}
 
-		bool prefixQueryInternal(const std::string& key, uint8_t* link_buffer) override
+		bool prefixQueryInternal(const std::string& key, uint8_t* link_buffer) const override
 		{
 			uint8_t current_mask = 0;
 
@@ -230,6 +246,12 @@ namespace osiris
 			uint8_t m0 = 128;
 			uint8_t m1 = 0;
 
+			// the top levels are resolved by a single lookup
+			if (!skipTopLevels(key, pos, m0, cur, s, hash_id))
+			{
+				return false;
+			}
+
 			uint8_t val = key[pos];
 			uint8_t val1 = 0;
 			uint8_t bit1;
@@ -270,6 +292,8 @@ namespace osiris
 						continue;
 				}
 
+				PREFETCH_CHILDREN(cur, s, hash_id);
+
 				// check the state of the node
 				this->leaf_masks->get(cur, &current_mask);
 
@@ -281,6 +305,11 @@ namespace osiris
 
 				// restoring next link in the set
 				link_len = extractLink(bit, cur, link_buffer);
+				// a broken link ---> no key is below the node
+				if (link_len == OSIRIS_BROKEN_LINK)
+				{
+					return false;
+				}
 				// updating hash to point to the next trie's node
 				UPDATE_HASH(cur, s, bit, hash_id, h1, h2)
 
@@ -294,7 +323,7 @@ namespace osiris
 		bool rangeQueryInternal(
 			const std::string& left, bool include_left,
 			const std::string& right, bool include_right,
-			uint8_t* prefix_buffer, uint8_t* tail_buffer)
+			uint8_t* prefix_buffer, uint8_t* tail_buffer) const
 		{
 			size_t left_key_size = left.size();
 
@@ -364,6 +393,8 @@ namespace osiris
 					continue;
 				}
 
+				PREFETCH_CHILDREN(cur, s, hash_id);
+
 				// extract state of the node
 				this->leaf_masks->get(cur, &is_leaf);
 
@@ -388,6 +419,11 @@ namespace osiris
 
 				// otherwise update link
 				link_len = extractLink(left_bit, cur, prefix_buffer);
+				// a broken link ---> no key is below the node
+				if (link_len == OSIRIS_BROKEN_LINK)
+				{
+					return false;
+				}
 				pt = 0;
 
 				// go to the next vertex
@@ -413,7 +449,7 @@ namespace osiris
 			size_t pos, uint8_t m0,
 			hash_t cur, hash_t current_seed, int hash_id,
 			bool include_tail, bool is_left,
-			bool can_pick, uint8_t* tail_buffer) {
+			bool can_pick, uint8_t* tail_buffer) const {
 
 			size_t key_len = key.size();
 
@@ -480,6 +516,7 @@ namespace osiris
 						continue;
 				}
 
+				PREFETCH_CHILDREN(cur, current_seed, hash_id);
 				this->leaf_masks->get(cur, &is_leaf);
 
 
@@ -499,6 +536,11 @@ namespace osiris
 
 				// restoring next link
 				link_len = extractLink(bit, cur, tail_buffer);
+				// a broken link ---> no key is below the node
+				if (link_len == OSIRIS_BROKEN_LINK)
+				{
+					return false;
+				}
 				// moving to the next node
 				UPDATE_HASH(cur, current_seed, bit, hash_id, h1, h2)
 
@@ -527,7 +569,7 @@ namespace osiris
 			size_t pos1, uint8_t m1, size_t len,
 			hash_t cur, hash_t s, int hash_id,
 			uint8_t* prefix_buffer, uint8_t* tail_buffer,
-			bool includeLeft)
+			bool includeLeft) const
 		{
 			size_t key_len = left.size();
 
@@ -578,7 +620,7 @@ namespace osiris
 			size_t pos1, uint8_t m1, size_t len,
 			hash_t cur, hash_t s, int hash_id,
 			uint8_t* prefix_buffer, uint8_t* tail_buffer,
-			bool include_right)
+			bool include_right) const
 		{
 			size_t key_len = right.size();
 
@@ -629,48 +671,78 @@ namespace osiris
 			return rangeQueryTail(right, pos, m0, cur, s, hash_id, include_right, false, true, tail_buffer);
 		}
 
+		//////////////////////////
+		/// Batched traversal ///
+		/////////////////////////
+
+		const Dictionary* nodeStateStorage() const override
+		{
+			return leaf_masks;
+		}
+
+		bool canDescend(uint8_t state, bool /*bit*/) const override
+		{
+			// a leaf has no links
+			return state != 0;
+		}
+
+		bool pointQueryFinal(hash_t hash) const override
+		{
+			uint8_t is_leaf = 0;
+			leaf_masks->get(hash, &is_leaf);
+			return is_leaf == 0;
+		}
+
+		bool admitBatchQuery(std::string_view key, bool /*is_point*/) const override
+		{
+			return (root_mask >> (((uint8_t)key[0]) >> 7)) & 1;
+		}
+
 		//////////////////////
 		/// Serialization ///
 		/////////////////////
 
-		uint8_t getFilterId() override
+		uint8_t getFilterId() const override
 		{
 			return 2;
 		}
 
-		uint8_t* serializeExtra(uint8_t* buf) override
+		uint8_t* serializeExtra(uint8_t* buf, SectionSink& sections) const override
 		{
 			memmove(buf , &root_mask, sizeof(root_mask));
 			buf += sizeof(root_mask);
-			buf = leaf_masks->serialize(buf);
+			buf = leaf_masks->serialize(buf, sections);
 			return buf;
 		}
 
-		size_t serializeExtraSize() override
+		size_t serializeExtraSize() const override
 		{
 			return leaf_masks->getSerializationSize() + sizeof(root_mask);
 		}
 
 	public:
-		NoPrefixFilter(const std::vector<std::string>& keys, KeySetInfo info)
+		NoPrefixFilter(const std::vector<std::string>& keys, KeySetInfo info, const BuildOptions& options = BuildOptions())
 		{
             root_mask = 0;
             root_mask |= (1 << (((uint8_t)keys[0][0]) >> 7));
             root_mask |= (1 << (((uint8_t)keys.back()[0]) >> 7));
 
-            auto retries = construct(keys, info);
-            OSIRIS_DEBUG_PRINT("retries: ", retries);
+            selectLayout(options);
+            build_retries = construct(keys, info);
+            OSIRIS_DEBUG_PRINT("retries: ", build_retries);
+            buildTopLevels(keys, options.top_level_bits);
+            buildPrefilter(keys, options.point_prefilter);
 
         }
 
-		NoPrefixFilter(uint8_t* buf)
+		NoPrefixFilter(uint8_t* buf, const FilterHeader& header = FilterHeader())
 		{
 			// assert(buf[0] == getFilterId());
-			buf = deserializeCore(buf);
+			buf = deserializeCore(buf, header);
 
 			memmove(&root_mask, buf, sizeof(root_mask));
 			buf += sizeof(root_mask);
-			leaf_masks = deserializeDictionary(buf).first;
+			leaf_masks = loadDictionary(buf).first;
 		}
 
 		~NoPrefixFilter() override
@@ -22,41 +22,300 @@
 #include "fixed_filter.h"
 #include "no_prefix_filter.h"
 #include "common_filter.h"
+#include "radix_filter.h"
+
+// sections of a file opened as a view up to this size are read at once, see LoadOptions
+#ifndef OSIRIS_EAGER_SECTION_BYTES
+#define OSIRIS_EAGER_SECTION_BYTES 65536
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace osiris
 {
 
-    inline OsirisFilter* build(const std::vector<std::string>& keys)
+    inline OsirisFilter* build(const std::vector<std::string>& keys, const BuildOptions& options = BuildOptions())
 	{
 		KeySetInfo info = check(keys);
 		switch (info.type)
 		{
 		case 0:
-			return new FixedLengthFilter(keys, info);
+			if (options.radix_bits == 4 || options.radix_bits == 8)
+			{
+				return new RadixFilter(keys, info, options);
+			}
+			return new FixedLengthFilter(keys, info, options);
 		case 1:
-			return new NoPrefixFilter(keys, info);
+			return new NoPrefixFilter(keys, info, options);
 		case 2:
-			return new CommonFilter(keys, info);
+			return new CommonFilter(keys, info, options);
 		default:
 			return nullptr;
 			break;
 		}
 	}
 
-    inline OsirisFilter* deserialize(uint8_t* buffer)
+    // Builds the filter into the file at the path: the cells of its dictionaries are allocated in the mapped file,
+    // which holds the serialized filter once it is returned, without a separate serialization. The filter keeps
+    // its cells in the file. nullptr if the file cannot be created or written, the file is then removed rather
+    // than left truncated
+    inline OsirisFilter* build(const std::vector<std::string>& keys, const std::string& path,
+                               const BuildOptions& options = BuildOptions())
 	{
-		switch (buffer[0])
+		// the file is sparse, so the room may be generous: the links take fewer bits than the keys,
+		// the rest of a dictionary at most a few bytes per key
+		uint64_t key_bytes = 0;
+		for (const auto& key : keys)
+		{
+			key_bytes += key.size();
+		}
+		BuildOptions file_options = options;
+		file_options.output = OutputFile::create(path, 2 * key_bytes + 64 * keys.size() + (1ull << 20));
+		if (!file_options.output)
+		{
+			return nullptr;
+		}
+		OsirisFilter* filter = build(keys, file_options);
+		if (!filter || !filter->finishOutput())
+		{
+			delete filter;
+			file_options.output.reset();
+#if defined(__unix__) || defined(__APPLE__)
+			::unlink(path.c_str());
+#endif
+			return nullptr;
+		}
+		return filter;
+	}
+
+    // creates the filter the header describes from the rest of the stream, nullptr if its metadata is damaged
+    inline OsirisFilter* restore(const FilterHeader& header, uint8_t* body)
+	{
+		if (header.features & ~OSIRIS_SUPPORTED_FEATURES)
+		{
+			return nullptr;
+		}
+		OsirisFilter* filter;
+		switch (header.id)
 		{
 		case 1:
-			return new FixedLengthFilter(buffer + 1);
+			filter = new FixedLengthFilter(body, header);
+			break;
 		case 2:
-			return new NoPrefixFilter(buffer + 1);
+			filter = new NoPrefixFilter(body, header);
+			break;
 		case 3:
-			return new CommonFilter(buffer + 1);
+			filter = new CommonFilter(body, header);
+			break;
+		case 4:
+			filter = new RadixFilter(body, header);
+			break;
 		default:
 			return nullptr;
 		}
+		if (filter->isDamaged())
+		{
+			delete filter;
+			return nullptr;
+		}
+		return filter;
+	}
+
+    // reads a stream of either format, nullptr if it is damaged or holds no supported filter
+    inline OsirisFilter* load(const uint8_t* buffer, size_t size, SerialSource source, bool verify_sections)
+	{
+		// the buffer is never written, only the dictionaries built by a filter are
+		uint8_t* meta = const_cast<uint8_t*>(buffer);
+		if (isSectioned(buffer))
+		{
+			meta = openSections(buffer, size, verify_sections, source);
+			if (!meta)
+			{
+				return nullptr;
+			}
+		}
+		auto [header, body] = readHeader(meta);
+		header.source = source;
+		return restore(header, body);
+	}
+
+    // Loads the filter from the stream written by serialize(), or by versions before the sectioned format.
+    // Everything is copied out of the stream, so the checksums of all sections are checked too
+    inline OsirisFilter* deserialize(uint8_t* buffer)
+	{
+		return load(buffer, sectionedSize(buffer), SerialSource(), true);
+	}
+
+    // how a view loads the sections of a stream
+    struct LoadOptions
+	{
+		// check the checksums of all sections, not only those of the header and the section table
+		bool verify_sections = false;
+		// sections up to this size are copied at once, larger ones stay in the buffer and are read by the queries
+		// that touch them, so only the touched pages of a mapped file are ever read from disk
+		size_t eager_section_bytes = OSIRIS_EAGER_SECTION_BYTES;
+		// Tell the kernel not to read ahead around the pages of the large sections of a mapped file. Resident memory
+		// then grows only by the pages the queries touch, but each of them costs a read of its own: it pays off
+		// for a filter that is opened to answer a few queries, not for one that serves many
+		bool random_access = false;
+		// For a mapped filter larger than memory: the large sections are read with random_access, and batch queries
+		// request the pages of the cells all their queries probe next before reading any of them, so many reads
+		// are in flight at once. The page cache keeps the pages that are hit often
+		bool on_disk = false;
+	};
+
+    // Loads the filter without copying its large dictionaries and link heap: they point into the buffer, which
+    // must stay alive and unchanged while the filter is used. The top level table is copied as well
+    inline OsirisFilter* deserializeView(const uint8_t* buffer, size_t size, const LoadOptions& options = LoadOptions())
+	{
+		SerialSource source;
+		source.view_end = buffer + size;
+		source.eager_bytes = options.eager_section_bytes;
+		source.on_disk = options.on_disk;
+		return load(buffer, size, source, options.verify_sections);
 	}
+
+    // Read-only filter over serialized data it does not copy: a caller-owned buffer, or a file mapped to memory,
+    // whose pages are shared through the page cache by every process that maps the same file
+    class OsirisFilterView
+	{
+		OsirisFilter* filter = nullptr;
+		void* mapping = nullptr;
+		size_t mapping_size = 0;
+
+		OsirisFilterView() = default;
+
+#if defined(__unix__) || defined(__APPLE__)
+		// The small sections are about to be copied, so they are read ahead in one go
+		static void adviseSections(const uint8_t* mapping, size_t size, const LoadOptions& options)
+		{
+			SerialSource source;
+			if (!isSectioned(mapping) || !openSections(mapping, size, false, source))
+			{
+				return;
+			}
+			size_t page = sysconf(_SC_PAGESIZE);
+			for (uint32_t i = 0; i < source.section_count; ++i)
+			{
+				SectionEntry entry = source.section(i);
+				size_t start = entry.offset & ~(page - 1);
+				size_t end = entry.offset + entry.size;
+				if (entry.size <= options.eager_section_bytes)
+				{
+					madvise((void*)(mapping + start), end - start, MADV_WILLNEED);
+				}
+				else if (options.random_access || options.on_disk)
+				{
+					madvise((void*)(mapping + start), end - start, MADV_RANDOM);
+				}
+			}
+		}
+#endif
+	public:
+		OsirisFilterView(const uint8_t* buffer, size_t size, const LoadOptions& options = LoadOptions())
+			: filter(deserializeView(buffer, size, options)) {}
+
+		OsirisFilterView(const OsirisFilterView&) = delete;
+		OsirisFilterView& operator=(const OsirisFilterView&) = delete;
+
+		// Maps the file written from serialize(), nullptr if it cannot be mapped or holds no supported filter.
+		// The small sections are read at once, the large ones as the queries fault their pages in
+		static OsirisFilterView* open(const std::string& path, const LoadOptions& options = LoadOptions())
+		{
+#if defined(__unix__) || defined(__APPLE__)
+			int fd = ::open(path.c_str(), O_RDONLY);
+			if (fd < 0)
+			{
+				return nullptr;
+			}
+			struct stat info;
+			if (fstat(fd, &info) != 0 || info.st_size == 0)
+			{
+				::close(fd);
+				return nullptr;
+			}
+			size_t size = info.st_size;
+			void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+			// the mapping keeps the file alive
+			::close(fd);
+			if (mapping == MAP_FAILED)
+			{
+				return nullptr;
+			}
+			adviseSections((const uint8_t*)mapping, size, options);
+			auto* view = new OsirisFilterView();
+			view->mapping = mapping;
+			view->mapping_size = size;
+			view->filter = deserializeView((const uint8_t*)mapping, size, options);
+			if (!view->filter)
+			{
+				delete view;
+				return nullptr;
+			}
+			return view;
+#else
+			return nullptr;
+#endif
+		}
+
+		~OsirisFilterView()
+		{
+			delete filter;
+#if defined(__unix__) || defined(__APPLE__)
+			if (mapping)
+			{
+				munmap(mapping, mapping_size);
+			}
+#endif
+		}
+
+		// false if the buffer holds no supported filter
+		bool valid() const
+		{
+			return filter != nullptr;
+		}
+
+		const OsirisFilter* get() const
+		{
+			return filter;
+		}
+
+		bool pointQuery(const std::string& key) const
+		{
+			return filter->pointQuery(key);
+		}
+
+		bool prefixQuery(const std::string& prefix) const
+		{
+			return filter->prefixQuery(prefix);
+		}
+
+		bool rangeQuery(const std::string& left, bool include_left, const std::string& right, bool include_right) const
+		{
+			return filter->rangeQuery(left, include_left, right, include_right);
+		}
+
+		void pointQueryBatch(std::span<const std::string> keys, uint8_t* result) const
+		{
+			filter->pointQueryBatch(keys, result);
+		}
+
+		void prefixQueryBatch(std::span<const std::string> prefixes, uint8_t* result) const
+		{
+			filter->prefixQueryBatch(prefixes, result);
+		}
+
+		void rangeQueryBatch(std::span<const std::string> left, std::span<const std::string> right,
+		                     bool include_left, bool include_right, uint8_t* result) const
+		{
+			filter->rangeQueryBatch(left, right, include_left, include_right, result);
+		}
+	};
 }
 
 #endif
\ No newline at end of file
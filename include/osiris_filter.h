@@ -21,16 +21,148 @@
 
 #include "bfd.h"
 #include "keys_utils.h"
+#include <array>
+#include <bit>
 #include <chrono>
+#include <memory>
+#include <mutex>
 #include <random>
+#include <span>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 
+// maximal number of trie levels whose child seeds are cached, deeper levels compute them on the fly
 #ifndef OSIRIS_HASH_CACHE_SIZE
 #define OSIRIS_HASH_CACHE_SIZE 1024
 #endif
 
+// set in the filter id byte when the id is followed by the extended header
+#define OSIRIS_EXTENDED_HEADER 0x80
+
+// features of the extended header, filters with unknown ones are not loaded
+#define OSIRIS_FEATURE_COUNTER_HASH 0x1u
+#define OSIRIS_FEATURE_MIXED_LOCATION 0x2u
+#define OSIRIS_FEATURE_TOP_LEVELS 0x4u
+#define OSIRIS_FEATURE_POINT_PREFILTER 0x8u
+#define OSIRIS_FEATURE_LINK_HEAP 0x10u
+#define OSIRIS_FEATURE_COMPACT_LENGTHS 0x20u
+#define OSIRIS_SUPPORTED_FEATURES (OSIRIS_FEATURE_COUNTER_HASH | OSIRIS_FEATURE_MIXED_LOCATION | OSIRIS_FEATURE_TOP_LEVELS \
+    | OSIRIS_FEATURE_POINT_PREFILTER | OSIRIS_FEATURE_LINK_HEAP | OSIRIS_FEATURE_COMPACT_LENGTHS)
+
+// the table of the top levels has 2^bits entries, so the number of bits is limited
+#ifndef OSIRIS_MAX_TOP_LEVEL_BITS
+#define OSIRIS_MAX_TOP_LEVEL_BITS 20
+#endif
+
+// number of traversals kept in flight by the batched queries
+#ifndef OSIRIS_BATCH_SIZE
+#define OSIRIS_BATCH_SIZE 16
+#endif
+
 namespace osiris
 {
-    static std::mt19937 osiris_rng((uint32_t)std::chrono::steady_clock::now().time_since_epoch().count());
+    // one generator per thread building filters, threads started at once get different seeds
+    static thread_local std::mt19937 osiris_rng((uint32_t)(std::chrono::steady_clock::now().time_since_epoch().count() ^
+                                                           std::hash<std::thread::id>()(std::this_thread::get_id())));
+
+    // child seeds of every trie level: (h1, h2) of depth d are stored at 2d and 2d + 1
+    using DepthSeeds = std::vector<hash_t>;
+
+    // returns the child seeds of the first levels for the hash seed. The tables are read-only, so all
+    // filters with the same hash seed share one table, which lives while any of them does
+    inline std::shared_ptr<const DepthSeeds> acquireDepthSeeds(hash_t seed, size_t levels)
+    {
+        static std::mutex guard;
+        static std::unordered_map<hash_t, std::weak_ptr<const DepthSeeds>> tables;
+
+        // released after the lock, since releasing the last reference takes the lock again
+        std::shared_ptr<const DepthSeeds> table;
+        std::lock_guard<std::mutex> lock(guard);
+
+        auto& entry = tables[seed];
+        table = entry.lock();
+        if (table && table->size() >= 2 * levels)
+        {
+            return table;
+        }
+
+        auto* values = new DepthSeeds(2 * levels);
+        hash_t s = seed;
+        for (size_t d = 0; d < levels; ++d)
+        {
+            hash_t h1 = nextRand(nextRand(s));
+            hash_t h2 = nextRand(h1);
+            (*values)[2 * d] = h1;
+            (*values)[2 * d + 1] = h2;
+            s = h2;
+        }
+
+        std::shared_ptr<const DepthSeeds> result(values, [seed](const DepthSeeds* released)
+        {
+            {
+                std::lock_guard<std::mutex> lock(guard);
+                auto it = tables.find(seed);
+                // the entry may already point to a longer table of the same seed
+                if (it != tables.end() && it->second.expired())
+                {
+                    tables.erase(it);
+                }
+            }
+            delete released;
+        });
+        entry = result;
+        return result;
+    }
+
+    // optional parts of a filter, chosen when it is built
+    struct BuildOptions
+    {
+        // number of leading key bits resolved by a single lookup in a dense table, 0 --- no table
+        uint32_t top_level_bits = 0;
+        // keep a fingerprint of every key, so most point queries for absent keys are answered
+        // without walking the trie
+        bool point_prefilter = false;
+        // 4 or 8: keys of the same length are stored in a trie whose nodes branch on that many bits at once,
+        // any other value --- binary trie
+        uint32_t radix_bits = 0;
+        // store links one after another in a single array instead of power-of-two chunks,
+        // so a link costs one dictionary probe and one sequential read
+        bool link_heap = false;
+        // keep a 1-bit "has a link" flag per node and the exact lengths of the non-empty links only,
+        // instead of a whole-byte length per node
+        bool compact_lengths = false;
+        // file the cells of the dictionaries are built in, see build() with a path
+        std::shared_ptr<OutputFile> output;
+    };
+
+    // what precedes the core of a serialized filter
+    struct FilterHeader
+    {
+        uint8_t id = 0;
+        // filters written before the extended header have neither features nor depth
+        bool extended = false;
+        uint32_t features = 0;
+        uint32_t max_depth = 0;
+        // where the payloads of the dictionaries are, see deserializeDictionary
+        SerialSource source;
+    };
+
+    inline std::pair<FilterHeader, uint8_t*> readHeader(uint8_t* buf)
+    {
+        FilterHeader header;
+        header.id = buf[0] & ~OSIRIS_EXTENDED_HEADER;
+        header.extended = buf[0] & OSIRIS_EXTENDED_HEADER;
+        buf++;
+        if (header.extended)
+        {
+            memmove(&header.features, buf, sizeof(header.features));
+            buf += sizeof(header.features);
+            memmove(&header.max_depth, buf, sizeof(header.max_depth));
+            buf += sizeof(header.max_depth);
+        }
+        return { header, buf };
+    }
 
     class OsirisFilter
     {
@@ -42,22 +174,309 @@ namespace osiris
 
         uint32_t max_link_size_in_bits = 0;
 
+        // Length of a link that no key can have. The cells of a node no key reaches hold garbage: its link may be
+        // longer than any link, or lie outside the heap. Such a link is never read, the traversal takes it for
+        // a mismatch
+        static constexpr size_t OSIRIS_BROKEN_LINK = SIZE_MAX;
+
         hash_t hash_seed = 0;
 
-        hash_t hash_cache[OSIRIS_HASH_CACHE_SIZE] = { 0 };
+        // format features the filter is stored with, written in the extended header,
+        // new filters derive node hashes by depth and mix them before locating the cells
+        uint32_t features = OSIRIS_FEATURE_COUNTER_HASH | OSIRIS_FEATURE_MIXED_LOCATION;
+
+        // number of times the construction picked a new seed because some dictionary failed to peel
+        size_t build_retries = 0;
+
+        // number of nodes on the longest root-to-leaf path
+        uint32_t max_depth = 0;
+
+        NodeHasher hasher;
+
+        // the deepest node at or above bit top_bits of some key, a query resumes the traversal from it
+        struct TopNode
+        {
+            hash_t hash;
+            hash_t seed;
+            uint32_t depth;
+            // bit of the key the node branches on
+            uint32_t position;
+        };
+
+        // top_index maps the first top_bits bits of a key to its node in top_nodes,
+        // or to OSIRIS_NO_TOP_NODE if no key starts with them
+        static constexpr uint32_t OSIRIS_NO_TOP_NODE = UINT32_MAX;
+        uint32_t top_bits = 0;
+        std::vector<TopNode> top_nodes;
+        std::vector<uint32_t> top_index;
+
+        // xor filter over whole keys: the cells of a key xor to the fingerprint of its hash
+        Dictionary* prefilter = nullptr;
+        hash_t prefilter_seed = 0;
+
+        // links one after another, each one starting at a byte, when the filter is built with a link heap;
+        // heap_offsets[bit] then keeps the offsets of the non-empty links instead of links[bit]
+        std::vector<uint8_t> link_heap;
+        Dictionary* heap_offsets[2] = {nullptr};
+        // the heap queries read: link_heap, its copy in the output file, or the part of the buffer a view was loaded from
+        std::span<const uint8_t> heap_bytes;
+
+        // the stream the filter was loaded from, its data is referenced only by views
+        SerialSource source;
+        // the metadata of the stream points outside of it, the filter is dropped once it is loaded
+        bool damaged = false;
+
+        // the file the filter was built into, its dictionaries keep their cells there
+        std::shared_ptr<OutputFile> output;
+
+        // with compact lengths length[bit] keeps whether the link is empty, link_sizes[bit] the lengths of the others
+        Dictionary* link_sizes[2] = {nullptr};
+
+        // child seeds of the first cached_depth levels, owned by seed_table
+        std::shared_ptr<const DepthSeeds> seed_table;
+        const hash_t* depth_seeds = nullptr;
+        size_t cached_depth = 0;
+
+        NodeHasher nodeHasher() const
+        {
+            return { hash_seed, (features & OSIRIS_FEATURE_COUNTER_HASH) ? HASH_COUNTER : HASH_CHAIN };
+        }
+
+        bool mixLocations() const
+        {
+            return features & OSIRIS_FEATURE_MIXED_LOCATION;
+        }
+
+        void initSeedCache(size_t depth)
+        {
+            hasher = nodeHasher();
+            // seeds of the counter scheme are computed in place, only the chain needs a table
+            if (hasher.scheme == HASH_COUNTER)
+            {
+                return;
+            }
+            seed_table = acquireDepthSeeds(hash_seed, std::min(depth, (size_t)OSIRIS_HASH_CACHE_SIZE));
+            depth_seeds = seed_table->data();
+            cached_depth = seed_table->size() >> 1;
+        }
+
+        // turns on the optional ways of storing links the options ask for, must precede the construction
+        void selectLayout(const BuildOptions& options)
+        {
+            output = options.output;
+            if (options.link_heap)
+            {
+                features |= OSIRIS_FEATURE_LINK_HEAP;
+            }
+            if (options.compact_lengths)
+            {
+                features |= OSIRIS_FEATURE_COMPACT_LENGTHS;
+            }
+        }
+
+        // a dictionary of the filter being built, with its cells in the output file if there is one
+        Dictionary* newDictionary(size_t keys, size_t bits_per_entry) const
+        {
+            uint8_t* cells = nullptr;
+            if (output)
+            {
+                cells = output->allocate(prepareLayout(keys, bits_per_entry, mixLocations()).total_size_in_bytes);
+            }
+            return initDictionary(keys, bits_per_entry, mixLocations(), cells);
+        }
+
+        bool linkHeap() const
+        {
+            return features & OSIRIS_FEATURE_LINK_HEAP;
+        }
+
+        bool compactLengths() const
+        {
+            return features & OSIRIS_FEATURE_COMPACT_LENGTHS;
+        }
+
+        // parts of the links kept apart from length[bit] and links[bit], by the bit the link follows
+        struct LinkStorage
+        {
+            std::vector<std::pair<size_t, size_t>> offsets[2];
+            std::vector<std::pair<size_t, size_t>> sizes[2];
+        };
+
+        // Moves the collected links to link_heap, one after another in the order they were collected, and puts
+        // the offset of every non-empty link to offsets[bit]. The chunks are dropped, so no link dictionaries are built.
+        // The arrays of lengths and chunks are those of the bits first_bit, first_bit + 1, ...
+        void packLinkHeap(std::vector<std::pair<size_t, size_t>>* link_lengths,
+                          std::vector<std::pair<size_t, bitstring>> (*link_chunks)[32],
+                          size_t count, size_t first_bit,
+                          std::vector<std::pair<size_t, size_t>>* offsets)
+        {
+            link_heap.clear();
+            for (size_t a = 0; a < count; ++a)
+            {
+                auto& node_offsets = offsets[first_bit + a];
+                size_t chunk_id[32] = {0};
+                for (const auto& [id, size] : link_lengths[a])
+                {
+                    if (!size) continue;
+                    size_t offset = link_heap.size();
+                    node_offsets.emplace_back(id, offset);
+                    link_heap.resize(offset + BITS_TO_BYTES(size), 0);
+
+                    // chunks were cut from the start of the link, the longest first
+                    size_t pt = offset << 3;
+                    for (int b = 31; b >= 0; --b)
+                    {
+                        if (!(size & (1ull << b))) continue;
+                        const bitstring& chunk = link_chunks[a][b][chunk_id[b]++].second;
+                        if (b >= 3)
+                        {
+                            memcpy(link_heap.data() + (pt >> 3), chunk.data(), (1ull << b) >> 3);
+                        }
+                        else
+                        {
+                            for (size_t off = 0; off < (1ull << b); ++off)
+                            {
+                                link_heap[(pt + off) >> 3] |= chunk[off] << ((pt + off) & 7);
+                            }
+                        }
+                        pt += 1ull << b;
+                    }
+                }
+                for (auto& chunks : link_chunks[a])
+                {
+                    std::vector<std::pair<size_t, bitstring>>().swap(chunks);
+                }
+            }
+            heap_bytes = link_heap;
+            uint8_t* cells = output ? output->allocate(link_heap.size()) : nullptr;
+            if (cells)
+            {
+                memcpy(cells, link_heap.data(), link_heap.size());
+                std::vector<uint8_t>().swap(link_heap);
+                heap_bytes = { cells, heap_bytes.size() };
+            }
+        }
+
+        // Applies the optional layouts to the collected links: moves them to the heap and/or splits the lengths.
+        // The arrays of lengths and chunks are those of the bits first_bit, first_bit + 1, ...
+        // Returns the width of the values of length[bit].
+        size_t prepareLinkStorage(std::vector<std::pair<size_t, size_t>>* link_lengths,
+                                  std::vector<std::pair<size_t, bitstring>> (*link_chunks)[32],
+                                  size_t count, size_t first_bit, size_t max_link_length,
+                                  LinkStorage& storage)
+        {
+            if (linkHeap())
+            {
+                packLinkHeap(link_lengths, link_chunks, count, first_bit, storage.offsets);
+            }
+            if (!compactLengths())
+            {
+                return std::max<size_t>(std::bit_width(max_link_length), 1);
+            }
+            for (size_t a = 0; a < count; ++a)
+            {
+                for (auto& [id, size] : link_lengths[a])
+                {
+                    if (size)
+                    {
+                        storage.sizes[first_bit + a].emplace_back(id, size);
+                    }
+                    size = size != 0;
+                }
+            }
+            return 1;
+        }
+
+        // builds (or rebuilds, after a new seed is chosen) the dictionaries of the link storage
+        bool buildLinkStorage(hash_t* hashes, LinkStorage& storage)
+        {
+            size_t offset_bits = std::max<size_t>(std::bit_width(heap_bytes.size()), 1);
+            size_t size_bits = std::bit_width(max_link_size_in_bits);
+            bool built = true;
+            for (int i = 0; i < 2; ++i)
+            {
+                if (!storage.offsets[i].empty())
+                {
+                    if (!heap_offsets[i])
+                    {
+                        heap_offsets[i] = newDictionary(storage.offsets[i].size(), offset_bits);
+                    }
+                    built &= heap_offsets[i]->build(hashes, storage.offsets[i]);
+                }
+                if (!storage.sizes[i].empty())
+                {
+                    if (!link_sizes[i])
+                    {
+                        link_sizes[i] = newDictionary(storage.sizes[i].size(), size_bits);
+                    }
+                    built &= link_sizes[i]->build(hashes, storage.sizes[i]);
+                }
+            }
+            return built;
+        }
 
-        size_t extractLink(bool bit, hash_t hash, uint8_t* buffer)
+        // length of the link after the bit, loc is the location of the hash in length[bit]
+        size_t readLinkLength(bool bit, hash_t hash, const location_t& loc) const
         {
             size_t size = 0;
-            length[bit]->get(hash, (uint8_t*)&size);
+            length[bit]->retrieve(loc, (uint8_t*)&size);
+            // only the non-empty links take the second probe
+            if (size && compactLengths())
+            {
+                size = 0;
+                link_sizes[bit]->get(hash, (uint8_t*)&size);
+            }
+            // without the heap a link takes the chunks of the set bits of its size, and only those that some
+            // link has are stored
+            bool stored = linkHeap() || !(size & ~(size_t)links_mask[bit]);
+            return size <= max_link_size_in_bits && stored ? size : OSIRIS_BROKEN_LINK;
+        }
+
+        // chunks of a link do not depend on each other, so all of them are located and prefetched
+        // before any is read, and their cache misses overlap instead of going one after another
+        void locateLink(bool bit, hash_t hash, size_t size, location_t* chunks) const
+        {
+            if (size == OSIRIS_BROKEN_LINK) return;
+            // a link from the heap takes a single offset
+            if (linkHeap())
+            {
+                if (!size) return;
+                chunks[0] = heap_offsets[bit]->locate(hash);
+                heap_offsets[bit]->prefetch(chunks[0]);
+                return;
+            }
+            // most links are short, so only the set bits of the size are visited
+            for (size_t rest = size; rest; rest &= rest - 1)
+            {
+                int b = std::countr_zero(rest);
+                chunks[b] = links[bit][b]->locate(hash);
+                links[bit][b]->prefetch(chunks[b]);
+            }
+        }
 
-            for (int b = 31; b >= 3; b--)
+        // false if the link is broken, the buffer is left as it is then
+        bool gatherLink(bool bit, size_t size, const location_t* chunks, uint8_t* buffer) const
+        {
+            if (size == OSIRIS_BROKEN_LINK) return false;
+            if (linkHeap())
             {
-                if (size & (1ull << b))
+                if (!size) return true;
+                size_t offset = 0;
+                heap_offsets[bit]->retrieve(chunks[0], (uint8_t*)&offset);
+                if (offset > heap_bytes.size() || BITS_TO_BYTES(size) > heap_bytes.size() - offset)
                 {
-                    links[bit][b]->get(hash, buffer);
-                    buffer += (1ull << (b - 3));
+                    return false;
                 }
+                memcpy(buffer, heap_bytes.data() + offset, BITS_TO_BYTES(size));
+                return true;
+            }
+            // the longest chunks go first
+            for (size_t rest = size >> 3; rest; )
+            {
+                int b = std::bit_width(rest) - 1;
+                rest ^= 1ull << b;
+                links[bit][b + 3]->retrieve(chunks[b + 3], buffer);
+                buffer += (1ull << b);
             }
 
             if (size & 7)
@@ -67,60 +486,505 @@ namespace osiris
                 if (size & 1)
                 {
                     tmp = 0;
-                    links[bit][0]->get(hash, &tmp);
+                    links[bit][0]->retrieve(chunks[0], &tmp);
                     result |= tmp;
                 }
                 if (size & 2)
                 {
                     tmp = 0;
-                    links[bit][1]->get(hash, &tmp);
+                    links[bit][1]->retrieve(chunks[1], &tmp);
                     result = (result << 2) | tmp;
                 }
                 if (size & 4)
                 {
                     tmp = 0;
-                    links[bit][2]->get(hash, &tmp);
+                    links[bit][2]->retrieve(chunks[2], &tmp);
                     result = (result << 4) | tmp;
                 }
 
                 buffer[0] = result;
             }
+            return true;
+        }
 
-            return size;
+        // length of the link, OSIRIS_BROKEN_LINK if it is broken
+        size_t extractLink(bool bit, hash_t hash, uint8_t* buffer) const
+        {
+            size_t size = readLinkLength(bit, hash, length[bit]->locate(hash));
+
+            location_t chunks[32];
+            locateLink(bit, hash, size, chunks);
+            return gatherLink(bit, size, chunks, buffer) ? size : OSIRIS_BROKEN_LINK;
+        }
+
+        // seeds of the children of a node at the depth, the seed is the one the parent passed down
+        inline void childSeeds(hash_t seed, size_t depth, hash_t& h1, hash_t& h2) const
+        {
+            if (depth < cached_depth)
+            {
+                h1 = depth_seeds[2 * depth];
+                h2 = depth_seeds[2 * depth + 1];
+                return;
+            }
+            hasher.childSeeds(seed, depth, h1, h2);
+        }
+
+        // requests the cells a child node reads first: its link lengths and its state
+        void prefetchNode(hash_t hash) const
+        {
+            length[0]->prefetch(length[0]->locate(hash));
+            length[1]->prefetch(length[1]->locate(hash));
+            if (const Dictionary* state = nodeStateStorage())
+            {
+                state->prefetch(state->locate(hash));
+            }
+        }
+
+        // the same hash sequence UPDATE_HASH produces, used to reach both children in advance
+        void prefetchChildren(hash_t hash, hash_t seed, int hash_id) const
+        {
+            hash_t h1, h2;
+            childSeeds(seed, hash_id, h1, h2);
+            prefetchNode(hash ^ h1);
+            prefetchNode(hash ^ h2);
+        }
+
+        //////////////////
+        /// Top levels ///
+        //////////////////
+
+        static uint32_t topPrefix(std::string_view key, uint32_t bits)
+        {
+            uint32_t bytes = (bits + 7) >> 3;
+            uint32_t value = 0;
+            for (uint32_t i = 0; i < bytes; ++i)
+            {
+                value = (value << 8) | (uint8_t)key[i];
+            }
+            return value >> ((bytes << 3) - bits);
+        }
+
+        // follows the key from the root while the next node is still within the top levels
+        TopNode descendTopLevels(const std::string& key, uint8_t* link_buffer) const
+        {
+            size_t pos = 0;
+            hash_t cur = hash_seed;
+            hash_t s = hash_seed;
+            int hash_id = 0;
+            hash_t h1, h2;
+            while (pos < top_bits)
+            {
+                bool bit = (key[pos >> 3] >> (7 ^ (pos & 7))) & 1;
+                size_t link_len = extractLink(bit, cur, link_buffer);
+                // the branching bit is not a part of the link
+                if (link_len == OSIRIS_BROKEN_LINK || pos + 1 + link_len > top_bits) break;
+                size_t next = pos + 1 + link_len;
+                UPDATE_HASH(cur, s, bit, hash_id, h1, h2)
+                pos = next;
+            }
+            return { cur, s, (uint32_t)hash_id, (uint32_t)pos };
+        }
+
+        // fills the table from the built filter, so must be called once the final seed is chosen
+        void buildTopLevels(const std::vector<std::string>& keys, uint32_t bits)
+        {
+            top_bits = std::min(bits, (uint32_t)OSIRIS_MAX_TOP_LEVEL_BITS);
+            if (!top_bits)
+            {
+                return;
+            }
+            features |= OSIRIS_FEATURE_TOP_LEVELS;
+            top_index.assign(1ull << top_bits, OSIRIS_NO_TOP_NODE);
+
+            std::vector<uint8_t> link_buffer(((max_link_size_in_bits + 7) >> 3) + 1);
+            std::unordered_map<hash_t, uint32_t> known;
+            for (const auto& key : keys)
+            {
+                // shorter keys never take the table
+                if ((key.size() << 3) <= top_bits) continue;
+                uint32_t prefix = topPrefix(key, top_bits);
+                // keys are sorted, so keys with the same prefix follow each other
+                if (top_index[prefix] != OSIRIS_NO_TOP_NODE) continue;
+
+                TopNode node = descendTopLevels(key, link_buffer.data());
+                auto [it, inserted] = known.emplace(node.hash, (uint32_t)top_nodes.size());
+                if (inserted)
+                {
+                    top_nodes.push_back(node);
+                }
+                top_index[prefix] = it->second;
+            }
+        }
+
+        // moves the traversal of the key to its top node, returns false if no key starts like it
+        bool skipTopLevels(std::string_view key, size_t& pos, uint8_t& m0, hash_t& cur, hash_t& s, int& hash_id) const
+        {
+            if (!top_bits || (key.size() << 3) <= top_bits)
+            {
+                return true;
+            }
+            uint32_t entry = top_index[topPrefix(key, top_bits)];
+            if (entry == OSIRIS_NO_TOP_NODE)
+            {
+                return false;
+            }
+            const TopNode& node = top_nodes[entry];
+            pos = node.position >> 3;
+            m0 = 128 >> (node.position & 7);
+            cur = node.hash;
+            s = node.seed;
+            hash_id = (int)node.depth;
+            return true;
+        }
+
+        //////////////////////
+        /// Point prefilter ///
+        //////////////////////
+
+        static uint8_t keyFingerprint(hash_t hash)
+        {
+            return hash >> 56;
+        }
+
+        void buildPrefilter(const std::vector<std::string>& keys, bool enabled)
+        {
+            if (!enabled || keys.empty())
+            {
+                return;
+            }
+            features |= OSIRIS_FEATURE_POINT_PREFILTER;
+            auto* hashes = new hash_t[keys.size()];
+            std::vector<std::pair<size_t, size_t>> fingerprints(keys.size());
+            prefilter = newDictionary(keys.size(), 8);
+            while (true)
+            {
+                prefilter_seed = ((hash_t)osiris_rng() << 32) | osiris_rng();
+                for (size_t i = 0; i < keys.size(); ++i)
+                {
+                    hashes[i] = hashKey(keys[i], prefilter_seed);
+                    fingerprints[i] = { i, keyFingerprint(hashes[i]) };
+                }
+                if (prefilter->build(hashes, fingerprints)) break;
+                OSIRIS_DEBUG_PRINT("prefilter failed to build, retry");
+            }
+            delete[] hashes;
+        }
+
+        // false only if the key is surely absent
+        bool prefilterAdmits(std::string_view key) const
+        {
+            if (!prefilter)
+            {
+                return true;
+            }
+            hash_t hash = hashKey(key, prefilter_seed);
+            uint8_t value = 0;
+            prefilter->get(hash, &value);
+            return value == keyFingerprint(hash);
+        }
+
+        //////////////////////////
+        /// Batched traversal ///
+        /////////////////////////
+
+        // dictionary with the state of every node, read before leaving the node (if the filter keeps one)
+        virtual const Dictionary* nodeStateStorage() const
+        {
+            return nullptr;
+        }
+
+        // checks if the traversal can leave a node with the given state by the bit
+        virtual bool canDescend(uint8_t /*state*/, bool /*bit*/) const
+        {
+            return true;
+        }
+
+        // decides a point query whose key is fully traversed and ends in the node
+        virtual bool pointQueryFinal(hash_t /*hash*/) const
+        {
+            return true;
+        }
+
+        // filters the queries that are answered negatively before the traversal starts
+        virtual bool admitBatchQuery(std::string_view /*key*/, bool /*is_point*/) const
+        {
+            return true;
+        }
+
+        enum BatchStage : uint8_t
+        {
+            // state and length cells of the node are prefetched
+            BATCH_NODE,
+            // cells of the link chunks are prefetched
+            BATCH_LINK,
+            // state of the final node is prefetched
+            BATCH_FINAL
+        };
+
+        // a single point or prefix traversal, suspended after each issued prefetch
+        struct BatchLane
+        {
+            std::string_view key;
+            size_t index = 0;
+            size_t pos = 0;
+            size_t link_len = 0;
+            hash_t cur = 0;
+            hash_t s = 0;
+            int hash_id = 0;
+            uint8_t val = 0;
+            uint8_t m0 = 0;
+            bool bit = false;
+            BatchStage stage = BATCH_NODE;
+            location_t state_loc;
+            location_t length_loc;
+            location_t chunks[32];
+            uint8_t* link_buffer = nullptr;
+        };
+
+        static bool nextBatchBit(BatchLane& lane)
+        {
+            if (lane.m0 == 1)
+            {
+                lane.pos++;
+                lane.m0 = 128;
+                if (lane.pos == lane.key.size()) return false;
+                lane.val = lane.key[lane.pos];
+            }
+            else
+            {
+                lane.m0 >>= 1;
+            }
+            return true;
         }
 
-        inline hash_t nextHash(hash_t seed, size_t id)
+        // locates and prefetches everything the node of the lane reads
+        void enterBatchNode(BatchLane& lane) const
         {
-            if (id < OSIRIS_HASH_CACHE_SIZE)
+            lane.bit = (lane.val & lane.m0) > 0;
+            if (const Dictionary* state = nodeStateStorage())
             {
-                return hash_cache[id];
+                lane.state_loc = state->locate(lane.cur);
+                state->prefetch(lane.state_loc);
+            }
+            lane.length_loc = length[lane.bit]->locate(lane.cur);
+            length[lane.bit]->prefetch(lane.length_loc);
+            lane.stage = BATCH_NODE;
+        }
+
+        // advances the lane to its next prefetch, returns 0 or 1 once the query is answered, -1 otherwise
+        int stepBatchLane(BatchLane& lane, bool is_point) const
+        {
+            if (lane.stage == BATCH_FINAL)
+            {
+                return pointQueryFinal(lane.cur);
+            }
+
+            if (lane.stage == BATCH_NODE)
+            {
+                if (const Dictionary* state = nodeStateStorage())
+                {
+                    uint8_t value = 0;
+                    state->retrieve(lane.state_loc, &value);
+                    if (!canDescend(value, lane.bit))
+                    {
+                        return 0;
+                    }
+                }
+                size_t size = readLinkLength(lane.bit, lane.cur, lane.length_loc);
+                if (size == OSIRIS_BROKEN_LINK)
+                {
+                    return 0;
+                }
+                lane.link_len = size;
+                lane.stage = BATCH_LINK;
+                if (size)
+                {
+                    locateLink(lane.bit, lane.cur, size, lane.chunks);
+                    return -1;
+                }
+            }
+
+            if (!gatherLink(lane.bit, lane.link_len, lane.chunks, lane.link_buffer))
+            {
+                return 0;
+            }
+            hash_t h1, h2;
+            UPDATE_HASH(lane.cur, lane.s, lane.bit, lane.hash_id, h1, h2)
+
+            // the branching bit is not a part of the link
+            bool more = nextBatchBit(lane);
+            size_t pt = 0;
+            while (more && pt < lane.link_len)
+            {
+                bool bit = (lane.val & lane.m0) > 0;
+                bool link_bit = (lane.link_buffer[pt >> 3] >> (pt & 7)) & 1;
+                if (bit != link_bit)
+                {
+                    return 0;
+                }
+                pt++;
+                more = nextBatchBit(lane);
+            }
+
+            if (more)
+            {
+                enterBatchNode(lane);
+                return -1;
+            }
+            // the whole prefix is traversed
+            if (!is_point)
+            {
+                return 1;
+            }
+            // traversal ended in the middle of the link ---> there is no such key
+            if (pt < lane.link_len)
+            {
+                return 0;
+            }
+            const Dictionary* state = nodeStateStorage();
+            if (!state)
+            {
+                return pointQueryFinal(lane.cur);
+            }
+            lane.state_loc = state->locate(lane.cur);
+            state->prefetch(lane.state_loc);
+            lane.stage = BATCH_FINAL;
+            return -1;
+        }
+
+        // keeps up to OSIRIS_BATCH_SIZE traversals in flight and switches between them at every
+        // dictionary probe, so the cache misses of different queries overlap
+        template <typename KeyAt, typename Emit>
+        void traverseBatch(size_t count, KeyAt key_at, bool is_point, Emit emit) const
+        {
+            size_t buffer_size = (max_link_size_in_bits + 7) >> 3;
+            BatchLane* lanes = nullptr;
+            uint8_t* buffers = nullptr;
+            try
+            {
+                lanes = new BatchLane[OSIRIS_BATCH_SIZE];
+                buffers = new uint8_t[OSIRIS_BATCH_SIZE * std::max(buffer_size, (size_t)1)];
+            }
+            catch (std::bad_alloc&)
+            {
+                delete[] lanes;
+                // could not allocate memory for query, so cannot ensure there is no key
+                for (size_t i = 0; i < count; ++i)
+                {
+                    emit(i, true);
+                }
+                return;
+            }
+
+            size_t next = 0;
+            size_t active = 0;
+
+            // puts the next unanswered query into the lane, returns false if there are none left
+            auto fill = [&](BatchLane& lane) -> bool
+            {
+                while (next < count)
+                {
+                    size_t id = next++;
+                    std::string_view key = key_at(id);
+                    if (key.empty())
+                    {
+                        std::string copy(key);
+                        emit(id, is_point ? pointQuery(copy) : prefixQuery(copy));
+                        continue;
+                    }
+                    if (!admitBatchQuery(key, is_point) || (is_point && !prefilterAdmits(key)))
+                    {
+                        emit(id, false);
+                        continue;
+                    }
+                    lane.key = key;
+                    lane.index = id;
+                    lane.pos = 0;
+                    lane.link_len = 0;
+                    lane.cur = hash_seed;
+                    lane.s = hash_seed;
+                    lane.hash_id = 0;
+                    lane.m0 = 128;
+                    if (!skipTopLevels(key, lane.pos, lane.m0, lane.cur, lane.s, lane.hash_id))
+                    {
+                        emit(id, false);
+                        continue;
+                    }
+                    lane.val = key[lane.pos];
+                    enterBatchNode(lane);
+                    return true;
+                }
+                return false;
+            };
+
+            bool busy[OSIRIS_BATCH_SIZE];
+            for (size_t i = 0; i < OSIRIS_BATCH_SIZE; ++i)
+            {
+                lanes[i].link_buffer = buffers + i * buffer_size;
+                busy[i] = fill(lanes[i]);
+                active += busy[i];
+            }
+
+            while (active)
+            {
+                for (size_t i = 0; i < OSIRIS_BATCH_SIZE; ++i)
+                {
+                    if (!busy[i]) continue;
+                    int result = stepBatchLane(lanes[i], is_point);
+                    if (result < 0) continue;
+                    emit(lanes[i].index, result == 1);
+                    if (!fill(lanes[i]))
+                    {
+                        busy[i] = false;
+                        active--;
+                    }
+                }
+            }
+
+            delete[] lanes;
+            delete[] buffers;
+        }
+
+        static void setResultBit(uint8_t* result, size_t id, bool value)
+        {
+            if (value)
+            {
+                result[id >> 3] |= (uint8_t)(1u << (id & 7));
+            }
+            else
+            {
+                result[id >> 3] &= (uint8_t)~(1u << (id & 7));
             }
-            return nextRand(seed);
         }
 
         // implementation is too different
 
-        virtual bool pointQueryInternal(const std::string& key, uint8_t* link_buffer) = 0;
+        virtual bool pointQueryInternal(const std::string& key, uint8_t* link_buffer) const = 0;
 
-        virtual bool prefixQueryInternal(const std::string& prefix, uint8_t* link_buffer) = 0;
+        virtual bool prefixQueryInternal(const std::string& prefix, uint8_t* link_buffer) const = 0;
 
         virtual bool rangeQueryInternal(const std::string& left, bool includeLeft,
                                         const std::string& right, bool includeRight,
-                                        uint8_t* prefixBuffer, uint8_t* tailBuffer) = 0;
+                                        uint8_t* prefixBuffer, uint8_t* tailBuffer) const = 0;
 
         // serialization
 
-        virtual uint8_t getFilterId() = 0;
+        virtual uint8_t getFilterId() const = 0;
 
-        virtual uint8_t* serializeExtra(uint8_t* buf) = 0;
+        virtual uint8_t* serializeExtra(uint8_t* buf, SectionSink& sections) const = 0;
 
-        virtual size_t serializeExtraSize() = 0;
+        virtual size_t serializeExtraSize() const = 0;
 
-        uint8_t* serializeCore(uint8_t* buf)
+        // writes the metadata of the filter, the payloads are added to the sections
+        uint8_t* serializeCore(uint8_t* buf, SectionSink& sections) const
         {
-            uint8_t id = getFilterId();
+            uint8_t id = getFilterId() | OSIRIS_EXTENDED_HEADER;
             memmove(buf, &id, sizeof(id));
             buf += sizeof(id);
+            memmove(buf, &features, sizeof(features));
+            buf += sizeof(features);
+            memmove(buf, &max_depth, sizeof(max_depth));
+            buf += sizeof(max_depth);
             memmove(buf, &hash_seed, sizeof(hash_seed));
             buf += sizeof(hash_seed);
             memmove(buf, &max_link_size_in_bits, sizeof(max_link_size_in_bits));
@@ -128,7 +992,7 @@ namespace osiris
 
             for (int i = 0; i < 2; ++i)
             {
-                buf = length[i]->serialize(buf);
+                buf = length[i]->serialize(buf, sections);
 
                 memmove(buf, &links_mask[i], sizeof(links_mask[i]));
                 buf += sizeof(links_mask[i]);
@@ -137,17 +1001,75 @@ namespace osiris
                 {
                     if (links_mask[i] & (1ull << b))
                     {
-                        buf = links[i][b]->serialize(buf);
+                        buf = links[i][b]->serialize(buf, sections);
+                    }
+                }
+            }
+
+            if (features & OSIRIS_FEATURE_TOP_LEVELS)
+            {
+                uint32_t nodes = top_nodes.size();
+                memmove(buf, &top_bits, sizeof(top_bits));
+                buf += sizeof(top_bits);
+                memmove(buf, &nodes, sizeof(nodes));
+                buf += sizeof(nodes);
+                memmove(buf, top_nodes.data(), nodes * sizeof(TopNode));
+                buf += nodes * sizeof(TopNode);
+                memmove(buf, top_index.data(), top_index.size() * sizeof(uint32_t));
+                buf += top_index.size() * sizeof(uint32_t);
+            }
+
+            if (features & OSIRIS_FEATURE_POINT_PREFILTER)
+            {
+                memmove(buf, &prefilter_seed, sizeof(prefilter_seed));
+                buf += sizeof(prefilter_seed);
+                buf = prefilter->serialize(buf, sections);
+            }
+
+            if (linkHeap())
+            {
+                uint64_t bytes = heap_bytes.size();
+                memmove(buf, &bytes, sizeof(bytes));
+                buf += sizeof(bytes);
+                uint32_t section = sections.add(OSIRIS_SECTION_LINK_HEAP, heap_bytes.data(), bytes);
+                memmove(buf, &section, sizeof(section));
+                buf += sizeof(section);
+                for (int i = 0; i < 2; ++i)
+                {
+                    uint8_t present = heap_offsets[i] != nullptr;
+                    memmove(buf, &present, sizeof(present));
+                    buf += sizeof(present);
+                    if (present)
+                    {
+                        buf = heap_offsets[i]->serialize(buf, sections);
+                    }
+                }
+            }
+
+            if (compactLengths())
+            {
+                for (int i = 0; i < 2; ++i)
+                {
+                    uint8_t present = link_sizes[i] != nullptr;
+                    memmove(buf, &present, sizeof(present));
+                    buf += sizeof(present);
+                    if (present)
+                    {
+                        buf = link_sizes[i]->serialize(buf, sections);
                     }
                 }
             }
             return buf;
         }
 
-        size_t getSerializationSize()
+        // size of the metadata section
+        size_t getSerializationSize() const
         {
             size_t total_size = 1;
 
+            total_size += sizeof(features);
+            total_size += sizeof(max_depth);
+
             total_size += sizeof(hash_seed);
             total_size += sizeof(max_link_size_in_bits);
 
@@ -163,27 +1085,78 @@ namespace osiris
                     }
                 }
             }
+
+            if (features & OSIRIS_FEATURE_TOP_LEVELS)
+            {
+                total_size += sizeof(top_bits) + sizeof(uint32_t);
+                total_size += top_nodes.size() * sizeof(TopNode) + top_index.size() * sizeof(uint32_t);
+            }
+
+            if (features & OSIRIS_FEATURE_POINT_PREFILTER)
+            {
+                total_size += sizeof(prefilter_seed) + prefilter->getSerializationSize();
+            }
+
+            if (linkHeap())
+            {
+                total_size += sizeof(uint64_t) + sizeof(uint32_t);
+                for (int i = 0; i < 2; ++i)
+                {
+                    total_size += sizeof(uint8_t);
+                    if (heap_offsets[i])
+                    {
+                        total_size += heap_offsets[i]->getSerializationSize();
+                    }
+                }
+            }
+
+            if (compactLengths())
+            {
+                for (int i = 0; i < 2; ++i)
+                {
+                    total_size += sizeof(uint8_t);
+                    if (link_sizes[i])
+                    {
+                        total_size += link_sizes[i]->getSerializationSize();
+                    }
+                }
+            }
             return total_size + serializeExtraSize();
         }
 
-        uint8_t* deserializeCore(uint8_t* buf)
+        // Writes the metadata and collects the sections of the serialized filter, the returned metadata
+        // is the first section and must outlive the sink. The payloads follow in the order they are written
+        std::vector<uint8_t> collectSections(SectionSink& sections) const
+        {
+            std::vector<uint8_t> meta(getSerializationSize());
+            sections.add(OSIRIS_SECTION_META, meta.data(), meta.size());
+            serializeExtra(serializeCore(meta.data(), sections), sections);
+            return meta;
+        }
+
+        // dictionaries of a view point into its buffer, the others are copied
+        std::pair<Dictionary*, uint8_t*> loadDictionary(uint8_t* buf)
         {
+            auto result = deserializeDictionary(buf, mixLocations(), source);
+            damaged |= result.first == nullptr;
+            return result;
+        }
+
+        uint8_t* deserializeCore(uint8_t* buf, const FilterHeader& header)
+        {
+            features = header.features;
+            source = header.source;
+            // the depth of filters written without it is unknown ---> cache as many levels as they used to
+            max_depth = header.extended ? header.max_depth : OSIRIS_HASH_CACHE_SIZE / 3;
             memmove(&hash_seed, buf, sizeof(hash_seed));
             buf += sizeof(hash_seed);
-            if (OSIRIS_HASH_CACHE_SIZE > 0)
-            {
-                hash_cache[0] = nextRand(hash_seed);
-                for (int i = 1; i < OSIRIS_HASH_CACHE_SIZE; ++i)
-                {
-                    hash_cache[i] = nextRand(hash_cache[i - 1]);
-                }
-            }
+            initSeedCache(max_depth);
             memmove(&max_link_size_in_bits, buf, sizeof(max_link_size_in_bits));
             buf += sizeof(max_link_size_in_bits);
 
             for (int i = 0; i < 2; ++i)
             {
-                auto res = deserializeDictionary(buf);
+                auto res = loadDictionary(buf);
                 buf = res.second;
                 length[i] = res.first;
 
@@ -194,7 +1167,7 @@ namespace osiris
                 {
                     if (links_mask[i] & (1ull << b))
                     {
-                        res = deserializeDictionary(buf);
+                        res = loadDictionary(buf);
                         links[i][b] = res.first;
                         buf = res.second;
                     }
@@ -204,13 +1177,115 @@ namespace osiris
                     }
                 }
             }
+
+            if (features & OSIRIS_FEATURE_TOP_LEVELS)
+            {
+                uint32_t nodes;
+                memmove(&top_bits, buf, sizeof(top_bits));
+                buf += sizeof(top_bits);
+                memmove(&nodes, buf, sizeof(nodes));
+                buf += sizeof(nodes);
+                // the table is sized by the stream, so it is checked before it is allocated
+                uint64_t table_bytes = (uint64_t)nodes * sizeof(TopNode) + (sizeof(uint32_t) << std::min(top_bits, 31u));
+                if (top_bits > OSIRIS_MAX_TOP_LEVEL_BITS ||
+                    (source.meta_end && (source.meta_end < buf || table_bytes > (uint64_t)(source.meta_end - buf))))
+                {
+                    top_bits = 0;
+                    damaged = true;
+                    return buf;
+                }
+                top_nodes.resize(nodes);
+                memmove(top_nodes.data(), buf, nodes * sizeof(TopNode));
+                buf += nodes * sizeof(TopNode);
+                top_index.resize(1ull << top_bits);
+                memmove(top_index.data(), buf, top_index.size() * sizeof(uint32_t));
+                buf += top_index.size() * sizeof(uint32_t);
+                for (uint32_t entry : top_index)
+                {
+                    damaged |= entry != OSIRIS_NO_TOP_NODE && (entry >= nodes || top_nodes[entry].position > top_bits);
+                }
+            }
+
+            if (features & OSIRIS_FEATURE_POINT_PREFILTER)
+            {
+                memmove(&prefilter_seed, buf, sizeof(prefilter_seed));
+                buf += sizeof(prefilter_seed);
+                auto res = loadDictionary(buf);
+                prefilter = res.first;
+                buf = res.second;
+            }
+
+            if (linkHeap())
+            {
+                uint64_t bytes;
+                memmove(&bytes, buf, sizeof(bytes));
+                buf += sizeof(bytes);
+                uint8_t* heap = source.payload(buf, bytes);
+                if (!heap)
+                {
+                    damaged = true;
+                }
+                else if (source.view_end && bytes > source.eager_bytes)
+                {
+                    heap_bytes = { heap, bytes };
+                }
+                else
+                {
+                    link_heap.assign(heap, heap + bytes);
+                    heap_bytes = link_heap;
+                }
+                for (int i = 0; i < 2; ++i)
+                {
+                    uint8_t present;
+                    memmove(&present, buf, sizeof(present));
+                    buf += sizeof(present);
+                    if (present)
+                    {
+                        auto res = loadDictionary(buf);
+                        heap_offsets[i] = res.first;
+                        buf = res.second;
+                    }
+                }
+            }
+
+            if (compactLengths())
+            {
+                for (int i = 0; i < 2; ++i)
+                {
+                    uint8_t present;
+                    memmove(&present, buf, sizeof(present));
+                    buf += sizeof(present);
+                    if (present)
+                    {
+                        auto res = loadDictionary(buf);
+                        link_sizes[i] = res.first;
+                        buf = res.second;
+                    }
+                }
+            }
             return buf;
         }
 
     public:
 
-        bool pointQuery(const std::string& key)
+        // true if the stream the filter was loaded from is damaged, such a filter is never returned by a load
+        bool isDamaged() const
         {
+            return damaged;
+        }
+
+        // seeds rejected while building, 0 for deserialized filters
+        size_t getBuildRetries() const
+        {
+            return build_retries;
+        }
+
+        bool pointQuery(const std::string& key) const
+        {
+            if (!prefilterAdmits(key))
+            {
+                return false;
+            }
             uint8_t* link_buffer = nullptr;
             try
             {
@@ -227,7 +1302,7 @@ namespace osiris
             }
         }
 
-        bool prefixQuery(const std::string& prefix)
+        bool prefixQuery(const std::string& prefix) const
         {
             uint8_t* link_buffer = nullptr;
             try
@@ -245,7 +1320,7 @@ namespace osiris
             }
         }
 
-        bool rangeQuery(const std::string& left, bool include_left, const std::string& right, bool include_right)
+        bool rangeQuery(const std::string& left, bool include_left, const std::string& right, bool include_right) const
         {
             int res = compareEndpoints(left, right);
             uint8_t* buf1 = nullptr;
@@ -276,19 +1351,144 @@ namespace osiris
             }
         }
 
-        std::pair<uint8_t*, size_t> serialize()
+        // batched queries: the answer for the i-th query is written to the i-th bit of the result
+        // (bit i & 7 of the byte i >> 3), so the result must hold at least (count + 7) / 8 bytes
+
+        virtual void pointQueryBatch(std::span<const std::string> keys, uint8_t* result) const
         {
-            size_t size = getSerializationSize();
+            traverseBatch(keys.size(), [&](size_t i) { return std::string_view(keys[i]); }, true,
+                          [&](size_t i, bool value) { setResultBit(result, i, value); });
+        }
 
-            uint8_t* data = new uint8_t[size];
+        virtual void prefixQueryBatch(std::span<const std::string> prefixes, uint8_t* result) const
+        {
+            traverseBatch(prefixes.size(), [&](size_t i) { return std::string_view(prefixes[i]); }, false,
+                          [&](size_t i, bool value) { setResultBit(result, i, value); });
+        }
 
-            uint8_t* cur = serializeCore(data);
+        virtual void rangeQueryBatch(std::span<const std::string> left, std::span<const std::string> right,
+                             bool include_left, bool include_right, uint8_t* result) const
+        {
+            size_t count = std::min(left.size(), right.size());
 
-            serializeExtra(cur);
+            // every key of the range starts with the common prefix of its endpoints, so the prefixes
+            // are checked in a batch first and only the ranges that pass are traversed one by one
+            std::vector<size_t> candidates;
+            std::vector<size_t> prefix_length;
+            std::vector<size_t> survivors;
+            for (size_t i = 0; i < count; ++i)
+            {
+                auto mismatch = std::mismatch(left[i].begin(), left[i].end(), right[i].begin(), right[i].end());
+                size_t common = mismatch.first - left[i].begin();
+                if (common == 0 || compareEndpoints(left[i], right[i]) >= 0)
+                {
+                    setResultBit(result, i, rangeQuery(left[i], include_left, right[i], include_right));
+                    continue;
+                }
+                candidates.push_back(i);
+                prefix_length.push_back(common);
+            }
+
+            traverseBatch(candidates.size(),
+                          [&](size_t i) { return std::string_view(left[candidates[i]]).substr(0, prefix_length[i]); },
+                          false,
+                          [&](size_t i, bool value)
+                          {
+                              setResultBit(result, candidates[i], false);
+                              if (value) survivors.push_back(candidates[i]);
+                          });
+
+            for (size_t i : survivors)
+            {
+                setResultBit(result, i, rangeQuery(left[i], include_left, right[i], include_right));
+            }
+        }
+
+        std::pair<uint8_t*, size_t> serialize() const
+        {
+            SectionSink sections;
+            std::vector<uint8_t> meta = collectSections(sections);
+
+            uint64_t size = sections.layout();
+            uint8_t* data = new uint8_t[size];
+            sections.write(data, size);
 
             return { data, size };
         }
 
+        // size of the stream written from serialize() and the functions below
+        size_t serializedSize() const
+        {
+            SectionSink sections;
+            std::vector<uint8_t> meta = collectSections(sections);
+            return sections.layout();
+        }
+
+        // Writes the stream to the buffer, returns its size, 0 if the buffer is too small
+        size_t serializeInto(std::span<uint8_t> out) const
+        {
+            SectionSink sections;
+            std::vector<uint8_t> meta = collectSections(sections);
+            uint64_t size = sections.layout();
+            if (size > out.size())
+            {
+                return 0;
+            }
+            sections.write(out.data(), size);
+            return size;
+        }
+
+        // Completes the file the filter was built into, see build() with a path. Returns false if writing fails
+        bool finishOutput()
+        {
+            if (!output)
+            {
+                return false;
+            }
+            SectionSink sections;
+            std::vector<uint8_t> meta = collectSections(sections);
+            return output->finish(sections);
+        }
+
+        // The functions below write the stream straight from the dictionaries, which are not copied
+        // to a buffer first. They return false if writing fails
+
+        bool serializeTo(std::ostream& out) const
+        {
+            SectionSink sections;
+            std::vector<uint8_t> meta = collectSections(sections);
+            sections.stream(sections.layout(), [&](const uint8_t* data, size_t size)
+            {
+                out.write((const char*)data, (std::streamsize)size);
+            });
+            return !out.fail();
+        }
+
+#if defined(__unix__) || defined(__APPLE__)
+        // writes at the current offset of the file descriptor, by writev() of up to IOV_MAX pieces
+        bool serializeTo(int fd) const
+        {
+            SectionSink sections;
+            std::vector<uint8_t> meta = collectSections(sections);
+            std::vector<iovec> pieces;
+            bool written = true;
+            sections.stream(sections.layout(), [&](const uint8_t* data, size_t size)
+            {
+                if (size == 0)
+                {
+                    return;
+                }
+                pieces.push_back({ const_cast<uint8_t*>(data), size });
+                if (pieces.size() == IOV_MAX)
+                {
+                    written = written && writeFully(fd, pieces.data(), pieces.size());
+                    pieces.clear();
+                }
+            });
+            return written && writeFully(fd, pieces.data(), pieces.size());
+        }
+#endif
+
         virtual ~OsirisFilter()
         {
             for (size_t i = 0; i < 2; ++i)
@@ -302,6 +1502,11 @@ namespace osiris
                     }
                 }
             }
+            delete prefilter;
+            delete heap_offsets[0];
+            delete heap_offsets[1];
+            delete link_sizes[0];
+            delete link_sizes[1];
         }
     };
 }
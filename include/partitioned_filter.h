@@ -0,0 +1,298 @@
+/*
+ * This file is part of OsirisFilter <https://github.com/aplyusnin/OsirisFilter>.
+ * Copyright (C) 2024 Artem Plyusnin.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OSIRIS_PARTITIONED_FILTER_H
+#define OSIRIS_PARTITIONED_FILTER_H
+
+#include "filter_pack.h"
+
+// id of the fence index in the pack a partitioned filter is written to, the partitions have ids 0, 1, ...
+#define OSIRIS_FENCE_ID UINT64_MAX
+
+namespace osiris
+{
+    struct PartitionOptions
+    {
+        // keys of every partition but the last one, which may have fewer
+        size_t partition_keys = 1ull << 20;
+        // threads building the partitions, 0 --- one per core
+        unsigned threads = 0;
+        // options every partition is built with, except for an output file, which cannot be shared
+        BuildOptions build;
+    };
+
+    // Sorted keys split into partitions of consecutive keys, each one kept in a filter of its own. The first and
+    // the last key of every partition form the fence index, which sends a query to the only partition that may hold
+    // its answer, and answers it alone when the answer is a fence key. A build keeps the scratch memory of one
+    // partition per thread. A filter opened from a file loads a partition the first time a query reaches it
+    class PartitionedOsirisFilter
+    {
+        std::vector<std::string> first_keys;
+        std::vector<std::string> last_keys;
+        // partitions built in memory
+        std::vector<std::unique_ptr<OsirisFilter>> partitions;
+        // or the pack they were opened from
+        std::unique_ptr<FilterPack> pack;
+
+        PartitionedOsirisFilter() = default;
+
+        // the last partition whose first key is at most key, partitionCount() if key precedes them all
+        size_t locate(const std::string& key) const
+        {
+            auto it = std::upper_bound(first_keys.begin(), first_keys.end(), key);
+            if (it == first_keys.begin())
+            {
+                return first_keys.size();
+            }
+            return it - first_keys.begin() - 1;
+        }
+
+        // asks the partition, a partition that cannot be loaded may hold anything
+        template<typename Query>
+        bool ask(size_t index, Query&& query) const
+        {
+            const OsirisFilter* filter = partition(index);
+            return !filter || query(filter);
+        }
+
+        static bool startsWith(const std::string& key, const std::string& prefix)
+        {
+            return key.compare(0, prefix.size(), prefix) == 0;
+        }
+
+        // the checksum of the rest, the number of partitions, then the first and the last key of each of them
+        std::vector<uint8_t> writeFences() const
+        {
+            std::vector<uint8_t> result(sizeof(uint32_t) + sizeof(uint64_t));
+            uint64_t count = first_keys.size();
+            memmove(result.data() + sizeof(uint32_t), &count, sizeof(count));
+            for (size_t i = 0; i < count; ++i)
+            {
+                for (const std::string* key : { &first_keys[i], &last_keys[i] })
+                {
+                    uint32_t size = (uint32_t)key->size();
+                    result.insert(result.end(), (const uint8_t*)&size, (const uint8_t*)&size + sizeof(size));
+                    result.insert(result.end(), key->begin(), key->end());
+                }
+            }
+            uint32_t crc = crc32c(result.data() + sizeof(uint32_t), result.size() - sizeof(uint32_t));
+            memmove(result.data(), &crc, sizeof(crc));
+            return result;
+        }
+
+        // false if the fences are damaged
+        bool readFences(std::span<const uint8_t> fences)
+        {
+            uint32_t crc;
+            uint64_t count;
+            if (fences.size() < sizeof(crc) + sizeof(count))
+            {
+                return false;
+            }
+            memmove(&crc, fences.data(), sizeof(crc));
+            if (crc != crc32c(fences.data() + sizeof(crc), fences.size() - sizeof(crc)))
+            {
+                return false;
+            }
+            memmove(&count, fences.data() + sizeof(crc), sizeof(count));
+            size_t pos = sizeof(crc) + sizeof(count);
+            for (uint64_t i = 0; i < count; ++i)
+            {
+                for (auto* keys : { &first_keys, &last_keys })
+                {
+                    uint32_t size;
+                    if (fences.size() - pos < sizeof(size))
+                    {
+                        return false;
+                    }
+                    memmove(&size, fences.data() + pos, sizeof(size));
+                    pos += sizeof(size);
+                    if (fences.size() - pos < size)
+                    {
+                        return false;
+                    }
+                    keys->emplace_back((const char*)fences.data() + pos, size);
+                    pos += size;
+                }
+            }
+            return true;
+        }
+    public:
+        // keys must be sorted and unique, as for build()
+        PartitionedOsirisFilter(const std::vector<std::string>& keys, const PartitionOptions& options = PartitionOptions())
+        {
+            size_t size = std::max<size_t>(options.partition_keys, 1);
+            size_t count = (keys.size() + size - 1) / size;
+            for (size_t i = 0; i < count; ++i)
+            {
+                first_keys.push_back(keys[i * size]);
+                last_keys.push_back(keys[std::min((i + 1) * size, keys.size()) - 1]);
+            }
+            partitions.resize(count);
+
+            BuildOptions build_options = options.build;
+            build_options.output = nullptr;
+            std::atomic<size_t> next{0};
+            auto work = [&]
+            {
+                for (size_t i = next++; i < count; i = next++)
+                {
+                    std::vector<std::string> slice(keys.begin() + i * size,
+                                                   keys.begin() + std::min((i + 1) * size, keys.size()));
+                    partitions[i].reset(build(slice, build_options));
+                }
+            };
+            size_t threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+            std::vector<std::thread> workers;
+            for (size_t i = 1; i < std::min(threads, count); ++i)
+            {
+                workers.emplace_back(work);
+            }
+            work();
+            for (auto& worker : workers)
+            {
+                worker.join();
+            }
+        }
+
+        PartitionedOsirisFilter(const PartitionedOsirisFilter&) = delete;
+        PartitionedOsirisFilter& operator=(const PartitionedOsirisFilter&) = delete;
+
+        // Opens the file written by write(), nullptr if it cannot be mapped or is damaged. Only the fence index is read,
+        // a partition is loaded as a view the first time a query reaches it and the rest stays on disk
+        static PartitionedOsirisFilter* open(const std::string& path, const LoadOptions& options = LoadOptions())
+        {
+            std::unique_ptr<FilterPack> pack(FilterPack::open(path, options));
+            if (!pack || pack->size() == 0 || pack->id(pack->size() - 1) != OSIRIS_FENCE_ID)
+            {
+                return nullptr;
+            }
+            std::unique_ptr<PartitionedOsirisFilter> filter(new PartitionedOsirisFilter());
+            if (!filter->readFences(pack->stream(pack->size() - 1)) || filter->partitionCount() != pack->size() - 1)
+            {
+                return nullptr;
+            }
+            for (size_t i = 0; i < filter->partitionCount(); ++i)
+            {
+                if (pack->id(i) != i)
+                {
+                    return nullptr;
+                }
+            }
+            filter->pack = std::move(pack);
+            return filter.release();
+        }
+
+        // writes the partitions and the fence index as a filter pack, false if writing fails
+        bool write(const std::string& path) const
+        {
+            FilterPackWriter writer;
+            for (size_t i = 0; i < partitionCount(); ++i)
+            {
+                const OsirisFilter* filter = partition(i);
+                if (!filter)
+                {
+                    return false;
+                }
+                writer.add(i, filter);
+            }
+            std::vector<uint8_t> fences = writeFences();
+            writer.add(OSIRIS_FENCE_ID, fences.data(), fences.size());
+            return writer.write(path);
+        }
+
+        size_t partitionCount() const
+        {
+            return first_keys.size();
+        }
+
+        // the filter of the partition, nullptr if it is opened from a file and cannot be loaded
+        const OsirisFilter* partition(size_t index) const
+        {
+            return pack ? pack->at(index) : partitions[index].get();
+        }
+
+        bool pointQuery(const std::string& key) const
+        {
+            size_t p = locate(key);
+            if (p == partitionCount() || key > last_keys[p])
+            {
+                return false;
+            }
+            if (key == first_keys[p] || key == last_keys[p])
+            {
+                return true;
+            }
+            return ask(p, [&](const OsirisFilter* filter) { return filter->pointQuery(key); });
+        }
+
+        bool prefixQuery(const std::string& prefix) const
+        {
+            // the keys with the prefix follow one another, so they reach at most two partitions:
+            // the one before the prefix is found, and the next one if it starts with the prefix
+            size_t p = locate(prefix);
+            for (p = p == partitionCount() ? 0 : p; p < partitionCount(); ++p)
+            {
+                if (startsWith(first_keys[p], prefix) || startsWith(last_keys[p], prefix))
+                {
+                    return true;
+                }
+                if (first_keys[p] > prefix)
+                {
+                    return false;
+                }
+                if (last_keys[p] > prefix)
+                {
+                    return ask(p, [&](const OsirisFilter* filter) { return filter->prefixQuery(prefix); });
+                }
+            }
+            return false;
+        }
+
+        bool rangeQuery(const std::string& left, bool include_left, const std::string& right, bool include_right) const
+        {
+            auto afterLeft = [&](const std::string& key) { return key > left || (include_left && key == left); };
+            auto beforeRight = [&](const std::string& key) { return key < right || (include_right && key == right); };
+
+            // a range without fence keys lies inside one partition, or between two of them
+            size_t p = locate(left);
+            for (p = p == partitionCount() ? 0 : p; p < partitionCount(); ++p)
+            {
+                bool first_after = afterLeft(first_keys[p]), last_after = afterLeft(last_keys[p]);
+                if ((first_after && beforeRight(first_keys[p])) || (last_after && beforeRight(last_keys[p])))
+                {
+                    return true;
+                }
+                if (first_after)
+                {
+                    return false;
+                }
+                if (last_after)
+                {
+                    return ask(p, [&](const OsirisFilter* filter)
+                    {
+                        return filter->rangeQuery(left, include_left, right, include_right);
+                    });
+                }
+            }
+            return false;
+        }
+    };
+}
+
+#endif
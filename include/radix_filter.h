@@ -0,0 +1,452 @@
+/*
+ * This file is part of OsirisFilter <https://github.com/aplyusnin/OsirisFilter>.
+ * Copyright (C) 2024 Artem Plyusnin.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OSIRIS_RADIX_FILTER_H
+#define OSIRIS_RADIX_FILTER_H
+
+#include "osiris_filter.h"
+
+namespace osiris
+{
+    // Filter for keys of the same length, whose nodes branch on radix_bits (4 or 8) bits of a key at once.
+    // Every node keeps the link leading into it (in length[1] and links[1], by the hash of the node)
+    // and, unless it is a leaf, the mask of the digits its children start with (in length[0]).
+    // A child is reached by combining the hash of the node with the seed of the digit,
+    // so a byte of a dense key set costs 1 or 2 nodes instead of 8.
+    class RadixFilter : public OsirisFilter
+    {
+        uint32_t key_length;
+        uint8_t radix_bits;
+
+        size_t radix() const
+        {
+            return 1ull << radix_bits;
+        }
+
+        //////////////////////
+        /// Construction ///
+        /////////////////////
+
+        size_t construct(const std::vector<std::string>& keys, KeySetInfo& info)
+        {
+            size_t cnt = keys.size();
+            // there are less than cnt branching nodes, every one of them keeps radix bits
+            hash_t* hashes = new hash_t[2 * cnt + 5];
+            bitstring::init(1.2 * info.total_size + cnt * (radix() >> 3) + 64);
+            RadixKeySetData data;
+            data.hashes = hashes;
+            data.radix_bits = radix_bits;
+
+            for (int j = 0; j < 32; ++j)
+            {
+                data.link_chunks[j].reserve(cnt + 5);
+            }
+            data.link_lengths.reserve(2 * cnt + 5);
+            data.child_masks.reserve(cnt + 5);
+
+            bool built = true;
+
+            hash_seed = osiris_rng();
+            data.hasher = nodeHasher();
+
+            collectDataAndHashes(data, keys, 0ull, cnt - 1, 0ull, hash_seed);
+
+            max_link_size_in_bits = data.max_link_length;
+
+            // parts of the links kept apart from length[bit] and links[bit] in the optional layouts
+            LinkStorage link_storage;
+            size_t length_bits = prepareLinkStorage(&data.link_lengths, &data.link_chunks, 1, 1, data.max_link_length, link_storage);
+            built &= buildLinkStorage(hashes, link_storage);
+
+            for (int j = 0; j < 32; ++j)
+            {
+                if (!data.link_chunks[j].empty())
+                {
+                    links_mask[1] |= (1ull << j);
+
+                    links[1][j] = newDictionary(data.link_chunks[j].size(), 1ull << j);
+                    built &= links[1][j]->build(hashes, data.link_chunks[j]);
+                }
+            }
+            length[1] = newDictionary(data.link_lengths.size(), length_bits);
+            built &= length[1]->build(hashes, data.link_lengths);
+            length[0] = newDictionary(data.child_masks.size(), radix());
+            built &= length[0]->build(hashes, data.child_masks);
+
+            size_t retries = 0;
+            while (!built)
+            {
+                retries++;
+                hash_seed = osiris_rng();
+                data.hasher = nodeHasher();
+                data.id = 0;
+                collectHashes(data, keys, 0ull, cnt - 1, 0ull, hash_seed);
+                built = true;
+                built &= buildLinkStorage(hashes, link_storage);
+                for (int j = 0; j < 32; ++j)
+                {
+                    if (!data.link_chunks[j].empty())
+                    {
+                        built &= links[1][j]->build(hashes, data.link_chunks[j]);
+                        if (!built) goto FAIL;
+                    }
+                }
+                built &= length[1]->build(hashes, data.link_lengths);
+                if (!built) goto FAIL;
+                built &= length[0]->build(hashes, data.child_masks);
+            FAIL:;
+            }
+
+            max_depth = data.max_depth;
+            initSeedCache(max_depth);
+            bitstring::clear();
+            delete[] hashes;
+            return retries;
+        }
+
+        ///////////////
+        /// Digits ///
+        //////////////
+
+        // digits the children of a node start with, bit d of the mask is set iff digit d has a child
+        struct ChildMask
+        {
+            uint64_t words[4];
+        };
+
+        ChildMask childMask(hash_t hash) const
+        {
+            ChildMask mask{};
+            length[0]->get(hash, (uint8_t*)mask.words);
+            return mask;
+        }
+
+        static bool hasChild(const ChildMask& mask, size_t digit)
+        {
+            return (mask.words[digit >> 6] >> (digit & 63)) & 1;
+        }
+
+        // the smallest digit not less than from that has a child, -1 if there is none
+        int nextChild(const ChildMask& mask, size_t from) const
+        {
+            for (size_t w = from >> 6; (w << 6) < radix(); ++w)
+            {
+                uint64_t bits = mask.words[w];
+                if (w == (from >> 6))
+                {
+                    bits &= ~0ull << (from & 63);
+                }
+                if (bits)
+                {
+                    return (int)((w << 6) + std::countr_zero(bits));
+                }
+            }
+            return -1;
+        }
+
+        hash_t childHash(hash_t hash, size_t depth, size_t digit) const
+        {
+            return hash ^ hasher.digitSeed(depth, digit, radix());
+        }
+
+        // links keep the bits of a key in lsb-first order
+        size_t linkDigit(const uint8_t* buffer, size_t from) const
+        {
+            uint8_t value = (buffer[from >> 3] >> (from & 7)) & (radix() - 1);
+            return rev_bit[value] >> (8 - radix_bits);
+        }
+
+        void setDigit(std::string& key, size_t pos, size_t digit) const
+        {
+            size_t shift = 8 - radix_bits - (pos & 7);
+            uint8_t mask = (radix() - 1) << shift;
+            key[pos >> 3] = (char)(((uint8_t)key[pos >> 3] & ~mask) | (digit << shift));
+        }
+
+        // false for a broken link and for a link that runs past the end of the keys,
+        // both are read at nodes no key reaches
+        bool linkFits(size_t pos, size_t link_len) const
+        {
+            return link_len != OSIRIS_BROKEN_LINK && pos + link_len <= ((size_t)key_length << 3);
+        }
+
+        void copyLink(std::string& key, size_t pos, const uint8_t* buffer, size_t len) const
+        {
+            for (size_t t = 0; t < len; t += radix_bits)
+            {
+                setDigit(key, pos + t, linkDigit(buffer, t));
+            }
+        }
+
+        // compares the link starting at the bit pos with the key,
+        // a key that ends within the link is less than it
+        int compareLink(std::string_view key, size_t key_bits, size_t pos, const uint8_t* buffer, size_t len) const
+        {
+            for (size_t t = 0; t < len; t += radix_bits)
+            {
+                if (pos + t == key_bits) return 1;
+                size_t digit = linkDigit(buffer, t);
+                size_t expected = keyDigit(key, pos + t, radix_bits);
+                if (digit != expected) return digit < expected ? -1 : 1;
+            }
+            return 0;
+        }
+
+        ////////////////
+        /// Queries ///
+        //////////////
+
+        bool pointQueryInternal(const std::string& key, uint8_t* link_buffer) const override
+        {
+            // if key has wrong size ---> it does not belong to the set
+            if (key.size() != key_length) return false;
+
+            size_t total = (size_t)key_length << 3;
+            size_t pos = 0;
+            size_t depth = 0;
+            hash_t cur = hash_seed;
+            while (true)
+            {
+                // the link and the mask of a node are independent, so both are requested at once
+                prefetchNode(cur);
+                size_t link_len = extractLink(1, cur, link_buffer);
+                if (!linkFits(pos, link_len)) return false;
+                if (compareLink(key, total, pos, link_buffer, link_len) != 0) return false;
+                pos += link_len;
+                // the whole key is traversed ---> key exists
+                if (pos == total) return true;
+
+                size_t digit = keyDigit(key, pos, radix_bits);
+                if (!hasChild(childMask(cur), digit)) return false;
+                cur = childHash(cur, depth++, digit);
+                pos += radix_bits;
+            }
+        }
+
+        bool prefixQueryInternal(const std::string& prefix, uint8_t* link_buffer) const override
+        {
+            // all keys have the same size, so longer prefixes cannot occur
+            if (prefix.size() > key_length) return false;
+
+            size_t total = prefix.size() << 3;
+            size_t pos = 0;
+            size_t depth = 0;
+            hash_t cur = hash_seed;
+            while (pos < total)
+            {
+                prefetchNode(cur);
+                size_t link_len = extractLink(1, cur, link_buffer);
+                if (!linkFits(pos, link_len)) return false;
+                // the prefix may end within the link
+                if (compareLink(prefix, total, pos, link_buffer, std::min(link_len, total - pos)) != 0) return false;
+                pos += link_len;
+                if (pos >= total) return true;
+
+                size_t digit = keyDigit(prefix, pos, radix_bits);
+                if (!hasChild(childMask(cur), digit)) return false;
+                cur = childHash(cur, depth++, digit);
+                pos += radix_bits;
+            }
+            // the whole prefix is traversed ---> some key starts with it
+            return true;
+        }
+
+        // completes the key with the smallest key below the node, whose link is already copied and ends at pos
+        void completeLeftmost(hash_t cur, size_t depth, size_t pos, std::string& key, uint8_t* link_buffer) const
+        {
+            size_t total = (size_t)key_length << 3;
+            while (pos < total)
+            {
+                size_t digit = nextChild(childMask(cur), 0);
+                setDigit(key, pos, digit);
+                cur = childHash(cur, depth++, digit);
+                pos += radix_bits;
+
+                size_t link_len = extractLink(1, cur, link_buffer);
+                if (!linkFits(pos, link_len)) return;
+                copyLink(key, pos, link_buffer, link_len);
+                pos += link_len;
+            }
+        }
+
+        // the smallest key not less than the bound (greater if !inclusive), false if there is none
+        bool lowerBound(const std::string& bound, bool inclusive, std::string& key, uint8_t* link_buffer) const
+        {
+            size_t total = (size_t)key_length << 3;
+            // a longer bound is greater than every key it starts with
+            if (bound.size() > key_length) inclusive = false;
+            size_t bound_bits = std::min(bound.size(), (size_t)key_length) << 3;
+
+            // the deepest node on the path of the bound with a child greater than the bound
+            hash_t fork_hash = 0;
+            size_t fork_depth = 0;
+            size_t fork_pos = 0;
+            int fork_digit = -1;
+
+            size_t pos = 0;
+            size_t depth = 0;
+            hash_t cur = hash_seed;
+            while (true)
+            {
+                prefetchNode(cur);
+                size_t link_len = extractLink(1, cur, link_buffer);
+                // no key is below the node
+                if (!linkFits(pos, link_len)) break;
+                copyLink(key, pos, link_buffer, link_len);
+                int order = compareLink(bound, bound_bits, pos, link_buffer, link_len);
+                pos += link_len;
+                // every key below the node is greater than the bound
+                if (order > 0 || (order == 0 && pos == bound_bits && pos < total))
+                {
+                    completeLeftmost(cur, depth, pos, key, link_buffer);
+                    return true;
+                }
+                // every key below the node is less than the bound
+                if (order < 0) break;
+                // the key is equal to the bound
+                if (pos == total)
+                {
+                    if (inclusive) return true;
+                    break;
+                }
+
+                size_t digit = keyDigit(bound, pos, radix_bits);
+                ChildMask mask = childMask(cur);
+                int greater = nextChild(mask, digit + 1);
+                if (greater >= 0)
+                {
+                    fork_hash = cur;
+                    fork_depth = depth;
+                    fork_pos = pos;
+                    fork_digit = greater;
+                }
+                if (!hasChild(mask, digit)) break;
+                setDigit(key, pos, digit);
+                cur = childHash(cur, depth++, digit);
+                pos += radix_bits;
+            }
+
+            if (fork_digit < 0) return false;
+
+            // the key agrees with the bound up to the fork, where it takes the next greater digit
+            setDigit(key, fork_pos, fork_digit);
+            cur = childHash(fork_hash, fork_depth, fork_digit);
+            pos = fork_pos + radix_bits;
+            size_t link_len = extractLink(1, cur, link_buffer);
+            if (!linkFits(pos, link_len)) return false;
+            copyLink(key, pos, link_buffer, link_len);
+            completeLeftmost(cur, fork_depth + 1, pos + link_len, key, link_buffer);
+            return true;
+        }
+
+        bool rangeQueryInternal(
+            const std::string& left, bool include_left,
+            const std::string& right, bool include_right,
+            uint8_t* prefix_buffer, uint8_t* /*tail_buffer*/) const override
+        {
+            // the trie keeps whole keys, so the first key after the left endpoint is restored
+            // and compared with the right one
+            std::string key(key_length, 0);
+            if (!lowerBound(left, include_left, key, prefix_buffer))
+            {
+                return false;
+            }
+            int res = compareEndpoints(key, right);
+            return res < 0 || (res == 0 && include_right);
+        }
+
+        //////////////////////
+        /// Serialization ///
+        /////////////////////
+
+        uint8_t getFilterId() const override
+        {
+            return 4;
+        }
+
+        uint8_t* serializeExtra(uint8_t* buf, SectionSink&) const override
+        {
+            memmove(buf, &radix_bits, sizeof(radix_bits));
+            buf += sizeof(radix_bits);
+            memmove(buf, &key_length, sizeof(key_length));
+            return buf + sizeof(key_length);
+        }
+
+        size_t serializeExtraSize() const override
+        {
+            return sizeof(key_length) + sizeof(radix_bits);
+        }
+
+    public:
+
+        // the traversal of the binary filters does not apply, so queries of a batch are answered one by one
+
+        void pointQueryBatch(std::span<const std::string> keys, uint8_t* result) const override
+        {
+            std::vector<uint8_t> link_buffer(((max_link_size_in_bits + 7) >> 3) + 1);
+            for (size_t i = 0; i < keys.size(); ++i)
+            {
+                setResultBit(result, i, prefilterAdmits(keys[i]) && pointQueryInternal(keys[i], link_buffer.data()));
+            }
+        }
+
+        void prefixQueryBatch(std::span<const std::string> prefixes, uint8_t* result) const override
+        {
+            std::vector<uint8_t> link_buffer(((max_link_size_in_bits + 7) >> 3) + 1);
+            for (size_t i = 0; i < prefixes.size(); ++i)
+            {
+                setResultBit(result, i, prefixQueryInternal(prefixes[i], link_buffer.data()));
+            }
+        }
+
+        void rangeQueryBatch(std::span<const std::string> left, std::span<const std::string> right,
+                             bool include_left, bool include_right, uint8_t* result) const override
+        {
+            size_t count = std::min(left.size(), right.size());
+            for (size_t i = 0; i < count; ++i)
+            {
+                setResultBit(result, i, rangeQuery(left[i], include_left, right[i], include_right));
+            }
+        }
+
+        RadixFilter(const std::vector<std::string>& keys, KeySetInfo info, const BuildOptions& options = BuildOptions())
+        {
+            key_length = info.max_size;
+            radix_bits = options.radix_bits == 8 ? 8 : 4;
+
+            selectLayout(options);
+            build_retries = construct(keys, info);
+            OSIRIS_DEBUG_PRINT("retries: ", build_retries);
+            buildPrefilter(keys, options.point_prefilter);
+        }
+
+        // deserializing constructor
+        RadixFilter(uint8_t* buf, const FilterHeader& header = FilterHeader())
+        {
+            buf = deserializeCore(buf, header);
+
+            memmove(&radix_bits, buf, sizeof(radix_bits));
+            buf += sizeof(radix_bits);
+            memmove(&key_length, buf, sizeof(key_length));
+        }
+
+        ~RadixFilter() override = default;
+    };
+}
+
+#endif
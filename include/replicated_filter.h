@@ -0,0 +1,206 @@
+/*
+ * This file is part of OsirisFilter <https://github.com/aplyusnin/OsirisFilter>.
+ * Copyright (C) 2024 Artem Plyusnin.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OSIRIS_REPLICATED_FILTER_H
+#define OSIRIS_REPLICATED_FILTER_H
+
+#include "osiris.h"
+#include <fstream>
+#include <thread>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+namespace osiris
+{
+    // Copies of a filter, one in the memory of every NUMA node, each query is answered by the copy of the node
+    // the calling thread runs on. A copy is loaded by a thread bound to the cpus of its node, so its pages are
+    // placed on that node when they are first touched. Only Linux reports the nodes, elsewhere there is one copy
+    class ReplicatedOsirisFilter
+    {
+        std::vector<std::unique_ptr<OsirisFilter>> replicas;
+        // index of the copy of each node, by the number of the node
+        std::vector<size_t> replica_of_node;
+
+        // the numbers in a list of ranges like "0-3,8,10-11" from sysfs
+        static std::vector<unsigned> parseList(const std::string& list)
+        {
+            std::vector<unsigned> result;
+            size_t pos = 0;
+            while (pos < list.size())
+            {
+                size_t end = list.find(',', pos);
+                std::string range = list.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+                size_t dash = range.find('-');
+                try
+                {
+                    unsigned first = std::stoul(range.substr(0, dash));
+                    unsigned last = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+                    for (unsigned i = first; i <= last; ++i)
+                    {
+                        result.push_back(i);
+                    }
+                }
+                catch (std::exception&)
+                {
+                    return {};
+                }
+                pos = end == std::string::npos ? list.size() : end + 1;
+            }
+            return result;
+        }
+
+        static std::string readLine(const std::string& path)
+        {
+            std::ifstream in(path);
+            std::string line;
+            std::getline(in, line);
+            return line;
+        }
+
+        // the calling thread is moved to the cpus, false if it cannot be
+        static bool bindToCpus(const std::vector<unsigned>& cpus)
+        {
+#if defined(__linux__)
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            for (unsigned cpu : cpus)
+            {
+                if (cpu < CPU_SETSIZE)
+                {
+                    CPU_SET(cpu, &set);
+                }
+            }
+            return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+            (void)cpus;
+            return false;
+#endif
+        }
+    public:
+        // copies the filter, which may be an owned filter or a view, to every node
+        explicit ReplicatedOsirisFilter(const OsirisFilter& filter)
+        {
+            std::vector<uint8_t> stream(filter.serializedSize());
+            filter.serializeInto(stream);
+
+            std::vector<unsigned> nodes;
+#if defined(__linux__)
+            nodes = parseList(readLine("/sys/devices/system/node/online"));
+#endif
+            if (nodes.size() < 2)
+            {
+                replicas.emplace_back(deserialize(stream.data()));
+                replica_of_node.assign(1, 0);
+                return;
+            }
+
+            replicas.resize(nodes.size());
+            replica_of_node.assign(nodes.back() + 1, 0);
+            std::vector<std::thread> loaders;
+            for (size_t i = 0; i < nodes.size(); ++i)
+            {
+                replica_of_node[nodes[i]] = i;
+                std::string cpus = readLine("/sys/devices/system/node/node" + std::to_string(nodes[i]) + "/cpulist");
+                loaders.emplace_back([&, i, cpus]
+                {
+                    // a node without cpus, or one the thread may not run on, gets its copy from wherever it runs
+                    bindToCpus(parseList(cpus));
+                    replicas[i].reset(deserialize(stream.data()));
+                });
+            }
+            for (auto& loader : loaders)
+            {
+                loader.join();
+            }
+        }
+
+        ReplicatedOsirisFilter(const ReplicatedOsirisFilter&) = delete;
+        ReplicatedOsirisFilter& operator=(const ReplicatedOsirisFilter&) = delete;
+
+        // false if a copy could not be loaded
+        bool valid() const
+        {
+            for (auto& replica : replicas)
+            {
+                if (!replica)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        size_t replicaCount() const
+        {
+            return replicas.size();
+        }
+
+        const OsirisFilter* replica(size_t index) const
+        {
+            return replicas[index].get();
+        }
+
+        // the copy in the memory of the node the calling thread runs on
+        const OsirisFilter* local() const
+        {
+#if defined(__linux__)
+            unsigned cpu, node;
+            if (replicas.size() > 1 && getcpu(&cpu, &node) == 0 && node < replica_of_node.size())
+            {
+                return replicas[replica_of_node[node]].get();
+            }
+#endif
+            return replicas[0].get();
+        }
+
+        bool pointQuery(const std::string& key) const
+        {
+            return local()->pointQuery(key);
+        }
+
+        bool prefixQuery(const std::string& prefix) const
+        {
+            return local()->prefixQuery(prefix);
+        }
+
+        bool rangeQuery(const std::string& left, bool include_left, const std::string& right, bool include_right) const
+        {
+            return local()->rangeQuery(left, include_left, right, include_right);
+        }
+
+        void pointQueryBatch(std::span<const std::string> keys, uint8_t* result) const
+        {
+            local()->pointQueryBatch(keys, result);
+        }
+
+        void prefixQueryBatch(std::span<const std::string> prefixes, uint8_t* result) const
+        {
+            local()->prefixQueryBatch(prefixes, result);
+        }
+
+        void rangeQueryBatch(std::span<const std::string> left, std::span<const std::string> right,
+                             bool include_left, bool include_right, uint8_t* result) const
+        {
+            local()->rangeQueryBatch(left, right, include_left, include_right, result);
+        }
+    };
+}
+
+#endif
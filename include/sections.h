@@ -0,0 +1,585 @@
+/*
+ * This file is part of OsirisFilter <https://github.com/aplyusnin/OsirisFilter>.
+ * Copyright (C) 2024 Artem Plyusnin.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OSIRIS_SECTIONS_H
+#define OSIRIS_SECTIONS_H
+
+#include "utils.h"
+#include <array>
+#include <cstddef>
+#include <memory>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define OSIRIS_CRC32C_SSE42
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define OSIRIS_CRC32C_ARM
+#endif
+
+// Format v2: a header, a table of sections and the sections themselves. The first section holds the metadata of the
+// filter, laid out as the v1 stream, except that the cells of dictionaries and the link heap are replaced by the
+// numbers of the sections keeping them.
+#define OSIRIS_FORMAT_VERSION 2
+
+// sections start at offsets that are multiples of it, counted from the start of the stream
+#define OSIRIS_SECTION_ALIGNMENT 64
+
+#define OSIRIS_SECTION_META 1u
+#define OSIRIS_SECTION_DICTIONARY 2u
+#define OSIRIS_SECTION_LINK_HEAP 3u
+
+// bytes allocated after the cells of a dictionary, and left after every section,
+// so that the last cells can be read by whole words
+#define OSIRIS_DICTIONARY_PADDING 16
+
+// sections a filter built into an OutputFile may have, room for their table is reserved in front of the cells
+#define OSIRIS_OUTPUT_SECTIONS 256
+
+namespace osiris
+{
+    ///////////////
+    /// CRC32C ///
+    ///////////////
+
+    inline const uint32_t* crc32cTable()
+    {
+        static const auto table = []
+        {
+            std::array<uint32_t, 256> result{};
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t crc = i;
+                for (int k = 0; k < 8; ++k)
+                {
+                    crc = (crc >> 1) ^ (0x82f63b78u & (0u - (crc & 1)));
+                }
+                result[i] = crc;
+            }
+            return result;
+        }();
+        return table.data();
+    }
+
+    inline uint32_t crc32cSoftware(uint32_t crc, const uint8_t* data, size_t size)
+    {
+        const uint32_t* table = crc32cTable();
+        for (size_t i = 0; i < size; ++i)
+        {
+            crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+        }
+        return crc;
+    }
+
+#ifdef OSIRIS_CRC32C_SSE42
+    __attribute__((target("sse4.2")))
+    inline uint32_t crc32cHardware(uint32_t crc, const uint8_t* data, size_t size)
+    {
+        uint64_t value = crc;
+        size_t i = 0;
+#if defined(__x86_64__)
+        for (; i + 8 <= size; i += 8)
+        {
+            uint64_t word;
+            memcpy(&word, data + i, sizeof(word));
+            value = _mm_crc32_u64(value, word);
+        }
+#endif
+        crc = (uint32_t)value;
+        for (; i < size; ++i)
+        {
+            crc = _mm_crc32_u8(crc, data[i]);
+        }
+        return crc;
+    }
+
+    inline bool hasHardwareCrc32c()
+    {
+        static const bool supported = __builtin_cpu_supports("sse4.2");
+        return supported;
+    }
+#elif defined(OSIRIS_CRC32C_ARM)
+    inline uint32_t crc32cHardware(uint32_t crc, const uint8_t* data, size_t size)
+    {
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8)
+        {
+            uint64_t word;
+            memcpy(&word, data + i, sizeof(word));
+            crc = __crc32cd(crc, word);
+        }
+        for (; i < size; ++i)
+        {
+            crc = __crc32cb(crc, data[i]);
+        }
+        return crc;
+    }
+
+    inline bool hasHardwareCrc32c()
+    {
+        return true;
+    }
+#endif
+
+    // CRC32C (Castagnoli) of the bytes, by the crc32 instructions where the cpu has them
+    inline uint32_t crc32c(const uint8_t* data, size_t size)
+    {
+#if defined(OSIRIS_CRC32C_SSE42) || defined(OSIRIS_CRC32C_ARM)
+        if (hasHardwareCrc32c())
+        {
+            return ~crc32cHardware(~0u, data, size);
+        }
+#endif
+        return ~crc32cSoftware(~0u, data, size);
+    }
+
+    /////////////////
+    /// Sections ///
+    /////////////////
+
+    struct FormatHeader
+    {
+        char magic[8] = {'O', 'S', 'I', 'R', 'I', 'S', 'v', '2'};
+        uint32_t version = OSIRIS_FORMAT_VERSION;
+        uint32_t section_count = 0;
+        uint64_t total_size = 0;
+        // of the section table
+        uint32_t table_crc = 0;
+        // of the bytes above
+        uint32_t header_crc = 0;
+        uint8_t reserved[32] = {0};
+    };
+
+    static_assert(sizeof(FormatHeader) == OSIRIS_SECTION_ALIGNMENT);
+
+    struct SectionEntry
+    {
+        uint32_t kind = 0;
+        uint32_t crc = 0;
+        uint64_t offset = 0;
+        uint64_t size = 0;
+    };
+
+    inline uint64_t alignSection(uint64_t offset)
+    {
+        return (offset + OSIRIS_SECTION_ALIGNMENT - 1) & ~(uint64_t)(OSIRIS_SECTION_ALIGNMENT - 1);
+    }
+
+    // v1 streams start with the filter id, which is never the first byte of the magic
+    inline bool isSectioned(const uint8_t* buffer)
+    {
+        return memcmp(buffer, FormatHeader().magic, sizeof(FormatHeader::magic)) == 0;
+    }
+
+    // Sections of a stream being written. The payloads are not copied: they stay in the filter until written out.
+    class SectionSink
+    {
+        std::vector<SectionEntry> entries;
+        std::vector<const uint8_t*> payloads;
+        // kept here, so that it outlives the pieces passed out by stream()
+        FormatHeader header;
+    public:
+        // returns the number of the section, which the metadata keeps instead of the payload
+        uint32_t add(uint32_t kind, const uint8_t* data, size_t size)
+        {
+            SectionEntry entry;
+            entry.kind = kind;
+            entry.size = size;
+            entries.push_back(entry);
+            payloads.push_back(data);
+            return (uint32_t)(entries.size() - 1);
+        }
+
+        // places the sections one after another behind the header and the table, returns the size of the stream
+        uint64_t layout()
+        {
+            uint64_t offset = sizeof(FormatHeader) + entries.size() * sizeof(SectionEntry);
+            for (auto& entry : entries)
+            {
+                entry.offset = alignSection(offset);
+                offset = entry.offset + entry.size + OSIRIS_DICTIONARY_PADDING;
+            }
+            return alignSection(offset);
+        }
+
+        size_t size() const
+        {
+            return entries.size();
+        }
+
+        const SectionEntry& entry(size_t index) const
+        {
+            return entries[index];
+        }
+
+        const uint8_t* payload(size_t index) const
+        {
+            return payloads[index];
+        }
+
+        // puts the section at the offset, for streams laid out otherwise than by layout()
+        void place(size_t index, uint64_t offset)
+        {
+            entries[index].offset = offset;
+        }
+
+        // Computes the checksums of the placed sections and returns the header of the stream of the given size.
+        // The table follows the header, starting at entry(0)
+        const FormatHeader& seal(uint64_t total_size)
+        {
+            for (size_t i = 0; i < entries.size(); ++i)
+            {
+                entries[i].crc = crc32c(payloads[i], entries[i].size);
+            }
+            header = FormatHeader();
+            header.section_count = (uint32_t)entries.size();
+            header.total_size = total_size;
+            header.table_crc = crc32c((const uint8_t*)entries.data(), entries.size() * sizeof(SectionEntry));
+            header.header_crc = crc32c((const uint8_t*)&header, offsetof(FormatHeader, header_crc));
+            return header;
+        }
+
+        // Passes the laid out stream of the given size to out(data, size) piece by piece, in the order of the stream:
+        // the header, the table, then every section after the zeros in front of it. The payloads are passed where
+        // they are, the pieces stay valid as long as the sink and the payloads do
+        template<typename Out>
+        void stream(uint64_t total_size, Out&& out)
+        {
+            static const uint8_t zeros[OSIRIS_SECTION_ALIGNMENT + OSIRIS_DICTIONARY_PADDING] = {0};
+
+            // the checksums are computed first, the table precedes the sections
+            seal(total_size);
+            out((const uint8_t*)&header, sizeof(header));
+            out((const uint8_t*)entries.data(), entries.size() * sizeof(SectionEntry));
+            uint64_t offset = sizeof(header) + entries.size() * sizeof(SectionEntry);
+            for (size_t i = 0; i < entries.size(); ++i)
+            {
+                out(zeros, entries[i].offset - offset);
+                out(payloads[i], entries[i].size);
+                offset = entries[i].offset + entries[i].size;
+            }
+            out(zeros, total_size - offset);
+        }
+
+        // writes the laid out stream of the given size to memory
+        void write(uint8_t* out, uint64_t total_size)
+        {
+            stream(total_size, [&](const uint8_t* data, size_t size)
+            {
+                memmove(out, data, size);
+                out += size;
+            });
+        }
+    };
+
+#if defined(__unix__) || defined(__APPLE__)
+    // Writes the pieces to the file descriptor, retrying after short and interrupted writes. The pieces are consumed.
+    // Returns false if a write fails
+    inline bool writeFully(int fd, iovec* pieces, size_t count)
+    {
+        while (count > 0)
+        {
+            ssize_t written = writev(fd, pieces, (int)std::min<size_t>(count, IOV_MAX));
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            size_t left = (size_t)written;
+            while (count > 0 && left >= pieces->iov_len)
+            {
+                left -= pieces->iov_len;
+                ++pieces;
+                --count;
+            }
+            if (count > 0)
+            {
+                pieces->iov_base = (uint8_t*)pieces->iov_base + left;
+                pieces->iov_len -= left;
+            }
+        }
+        return true;
+    }
+
+    // writes the bytes to the file descriptor at the offset, retrying after short and interrupted writes
+    inline bool pwriteFully(int fd, const uint8_t* data, size_t size, uint64_t offset)
+    {
+        while (size > 0)
+        {
+            ssize_t written = pwrite(fd, data, size, (off_t)offset);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            data += written;
+            size -= (size_t)written;
+            offset += (uint64_t)written;
+        }
+        return true;
+    }
+#endif
+
+    // The file a filter is built into. The cells of its dictionaries are allocated in the mapped file at their final
+    // offsets, so the stream is complete once finish() writes the metadata, the header and the table around them.
+    // The file is sparse: the room reserved but never allocated takes no disk and is cut off by finish()
+    class OutputFile
+    {
+        int fd = -1;
+        uint8_t* base = nullptr;
+        uint64_t capacity = 0;
+        uint64_t used = 0;
+
+        OutputFile() = default;
+    public:
+        OutputFile(const OutputFile&) = delete;
+        OutputFile& operator=(const OutputFile&) = delete;
+
+        // creates the file with room for cells of up to capacity bytes, nullptr if it cannot be created and mapped,
+        // in which case a file the call has truncated is removed
+        static std::shared_ptr<OutputFile> create(const std::string& path, uint64_t capacity)
+        {
+#if defined(__unix__) || defined(__APPLE__)
+            std::shared_ptr<OutputFile> file(new OutputFile());
+            file->fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (file->fd < 0)
+            {
+                return nullptr;
+            }
+            // the table goes in front of the cells, so room for it is reserved
+            file->used = alignSection(sizeof(FormatHeader) + OSIRIS_OUTPUT_SECTIONS * sizeof(SectionEntry));
+            file->capacity = alignSection(file->used + capacity);
+            if (ftruncate(file->fd, (off_t)file->capacity) != 0)
+            {
+                ::unlink(path.c_str());
+                return nullptr;
+            }
+            void* mapping = mmap(nullptr, file->capacity, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0);
+            if (mapping == MAP_FAILED)
+            {
+                ::unlink(path.c_str());
+                return nullptr;
+            }
+            file->base = (uint8_t*)mapping;
+            return file;
+#else
+            (void)path;
+            (void)capacity;
+            return nullptr;
+#endif
+        }
+
+        // Zeroed cells of the given size, followed by the padding, at an offset aligned as a section is.
+        // nullptr once the room is used up: the cells are then allocated by the caller and written by finish()
+        uint8_t* allocate(uint64_t size)
+        {
+            uint64_t offset = alignSection(used);
+            if (offset + size + OSIRIS_DICTIONARY_PADDING > capacity)
+            {
+                return nullptr;
+            }
+            used = offset + size + OSIRIS_DICTIONARY_PADDING;
+            return base + offset;
+        }
+
+        // Leaves the sections allocated in the file where they are and writes the others after them, then writes
+        // the header and the table and cuts the file to the size of the stream. Returns false if writing fails
+        bool finish(SectionSink& sections)
+        {
+#if defined(__unix__) || defined(__APPLE__)
+            if (sections.size() > OSIRIS_OUTPUT_SECTIONS)
+            {
+                return false;
+            }
+            auto allocated = [&](const uint8_t* payload) { return payload >= base && payload < base + used; };
+            uint64_t end = used;
+            for (size_t i = 0; i < sections.size(); ++i)
+            {
+                if (allocated(sections.payload(i)))
+                {
+                    sections.place(i, sections.payload(i) - base);
+                }
+                else
+                {
+                    sections.place(i, alignSection(end));
+                    end = sections.entry(i).offset + sections.entry(i).size + OSIRIS_DICTIONARY_PADDING;
+                }
+            }
+            uint64_t total_size = alignSection(end);
+            const FormatHeader& header = sections.seal(total_size);
+            if (ftruncate(fd, (off_t)total_size) != 0 ||
+                !pwriteFully(fd, (const uint8_t*)&header, sizeof(header), 0) ||
+                !pwriteFully(fd, (const uint8_t*)&sections.entry(0), sections.size() * sizeof(SectionEntry), sizeof(header)))
+            {
+                return false;
+            }
+            for (size_t i = 0; i < sections.size(); ++i)
+            {
+                if (!allocated(sections.payload(i)) &&
+                    !pwriteFully(fd, sections.payload(i), sections.entry(i).size, sections.entry(i).offset))
+                {
+                    return false;
+                }
+            }
+            return true;
+#else
+            (void)sections;
+            return false;
+#endif
+        }
+
+        ~OutputFile()
+        {
+#if defined(__unix__) || defined(__APPLE__)
+            if (base)
+            {
+                munmap(base, capacity);
+            }
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+#endif
+        }
+    };
+
+    // Where the payloads of a stream being read are: inline in a v1 stream, in the sections of a v2 one.
+    // With view_end set dictionaries are views over the stream, which ends there, instead of copies
+    struct SerialSource
+    {
+        const uint8_t* view_end = nullptr;
+        // payloads of a view up to this size are copied anyway, so they are read while loading
+        uint64_t eager_bytes = 0;
+        // the view is over a mapped file that mostly stays on disk, see Dictionary::prefetch
+        bool on_disk = false;
+        const uint8_t* base = nullptr;
+        // end of the metadata section, nullptr for a v1 stream, whose metadata has no known size
+        const uint8_t* meta_end = nullptr;
+        // the table is read by copies of its entries, the stream needs not be aligned in memory
+        const uint8_t* sections = nullptr;
+        uint32_t section_count = 0;
+
+        SectionEntry section(uint32_t index) const
+        {
+            SectionEntry entry;
+            memmove(&entry, sections + index * sizeof(SectionEntry), sizeof(entry));
+            return entry;
+        }
+
+        // Returns the payload of the given size, buf is at its place in the metadata and is moved past it.
+        // nullptr if the metadata names a section that does not exist or has another size
+        uint8_t* payload(uint8_t*& buf, uint64_t size) const
+        {
+            if (!sections)
+            {
+                uint8_t* result = buf;
+                buf += size;
+                return result;
+            }
+            uint32_t index;
+            memmove(&index, buf, sizeof(index));
+            buf += sizeof(index);
+            if (index >= section_count)
+            {
+                return nullptr;
+            }
+            SectionEntry entry = section(index);
+            if (entry.size != size)
+            {
+                return nullptr;
+            }
+            return const_cast<uint8_t*>(base + entry.offset);
+        }
+    };
+
+    // Checks the header and the section table of a v2 stream of at most size bytes and points source to them.
+    // The metadata section is small and locates all others, so its checksum is always checked, with verify_sections
+    // set the checksums of all sections are checked as well. Returns the metadata section,
+    // nullptr if the stream is damaged
+    inline uint8_t* openSections(const uint8_t* buffer, uint64_t size, bool verify_sections, SerialSource& source)
+    {
+        FormatHeader header;
+        if (size < sizeof(header))
+        {
+            return nullptr;
+        }
+        memmove(&header, buffer, sizeof(header));
+        if (!isSectioned(buffer) || header.version != OSIRIS_FORMAT_VERSION ||
+            header.header_crc != crc32c(buffer, offsetof(FormatHeader, header_crc)) ||
+            header.total_size > size || header.section_count == 0 ||
+            sizeof(header) + (uint64_t)header.section_count * sizeof(SectionEntry) > header.total_size)
+        {
+            return nullptr;
+        }
+        source.base = buffer;
+        source.sections = buffer + sizeof(header);
+        source.section_count = header.section_count;
+        if (header.table_crc != crc32c(source.sections, header.section_count * sizeof(SectionEntry)))
+        {
+            return nullptr;
+        }
+        for (uint32_t i = 0; i < header.section_count; ++i)
+        {
+            SectionEntry entry = source.section(i);
+            if (entry.offset > header.total_size || entry.size > header.total_size - entry.offset)
+            {
+                return nullptr;
+            }
+            if ((verify_sections || i == 0) && entry.crc != crc32c(buffer + entry.offset, entry.size))
+            {
+                return nullptr;
+            }
+        }
+        SectionEntry meta = source.section(0);
+        if (meta.kind != OSIRIS_SECTION_META)
+        {
+            return nullptr;
+        }
+        source.meta_end = buffer + meta.offset + meta.size;
+        return const_cast<uint8_t*>(buffer + meta.offset);
+    }
+
+    // size of the stream from its header, 0 if the stream is not sectioned
+    inline uint64_t sectionedSize(const uint8_t* buffer)
+    {
+        if (!isSectioned(buffer))
+        {
+            return 0;
+        }
+        FormatHeader header;
+        memmove(&header, buffer, sizeof(header));
+        return header.total_size;
+    }
+}
+
+#endif
@@ -40,14 +40,30 @@ void debugPrint(Args ...args)
 #define OSIRIS_DEBUG_PRINT(...) ((void)0)
 #endif
 
+#if defined(__GNUC__) || defined(__clang__)
+#define OSIRIS_PREFETCH(address) __builtin_prefetch((address), 0, 3)
+#elif defined(_MSC_VER)
+#include <xmmintrin.h>
+#define OSIRIS_PREFETCH(address) _mm_prefetch((const char*)(address), _MM_HINT_T0)
+#else
+#define OSIRIS_PREFETCH(address) ((void)0)
+#endif
+
+// hash_id is the depth of the node being left
 #define UPDATE_HASH(hash, seed, bit, hash_id, h1, h2) { \
-		(h1) = nextHash((seed), (hash_id)++); \
-        (h1) = nextHash((h1), (hash_id)++); \
-		(h2) = nextHash((h1), (hash_id)++); \
+		childSeeds((seed), (hash_id)++, (h1), (h2)); \
 		(hash) ^= (bit) ? (h2) : (h1); \
 		(seed) = (h2); \
 	}
 
+// opt-in speculative prefetch of both children of the node being visited,
+// the child hashes are known before the key bit is checked
+#ifdef OSIRIS_ENABLE_CHILD_PREFETCH
+#define PREFETCH_CHILDREN(hash, seed, hash_id) prefetchChildren((hash), (seed), (hash_id))
+#else
+#define PREFETCH_CHILDREN(hash, seed, hash_id) ((void)0)
+#endif
+
 #define NEXT_BIT_IN_LOOP(key, pos, byte, bit, length) {\
 			if ((bit) == 1) { \
 				(pos)++; \
@@ -148,10 +164,12 @@ namespace osiris
 
     typedef uint64_t hash_t;
 
+    // positions are counted from the first cell of the first bucket, so they fit in 32 bits
+    // in dictionaries of any size, and the cells themselves are addressed by 64 bits
     struct location_t
     {
-        uint32_t position[4] = { 0, 0, 0, 0 };
-        uint32_t first_bucket = 0;
+        uint32_t position[4];
+        uint32_t first_bucket;
     };
 
     inline size_t split(const std::vector<std::string>& data, size_t pos, size_t l, size_t r)
@@ -198,27 +216,24 @@ namespace osiris
         return bits;
     }
 
-    // in practice, number of buckets rarely exceeds 550 and never exceeds 600
-    inline size_t cntB[1000];
-    inline size_t totB[1000];
-
-    inline void radixSortBucket(std::pair<location_t, uint8_t*>* loc, size_t n)
+    // sorts the locations by their first bucket, buckets are below the given count
+    inline void radixSortBucket(std::pair<location_t, uint8_t*>* loc, size_t n, size_t buckets)
     {
         auto* buffer = new std::pair<location_t, uint8_t*>[n];
-        memset(cntB, 0, sizeof(cntB));
-        memset(totB, 0, sizeof(totB));
+        // the count grows with the number of keys, so the counters are not kept in fixed global arrays
+        std::vector<size_t> total(buckets + 1, 0);
         for (size_t i = 0; i < n; ++i)
         {
-            cntB[loc[i].first.first_bucket]++;
+            total[loc[i].first.first_bucket + 1]++;
         }
 
-        for (size_t i = 1; i < 1000; ++i)
+        for (size_t i = 1; i <= buckets; ++i)
         {
-            totB[i] = totB[i - 1] + cntB[i - 1];
+            total[i] += total[i - 1];
         }
         for (size_t i = 0; i < n; ++i)
         {
-            buffer[totB[loc[i].first.first_bucket]++] = std::move(loc[i]);
+            buffer[total[loc[i].first.first_bucket]++] = std::move(loc[i]);
         }
         for (size_t i = 0; i < n; ++i)
         {